@@ -10,9 +10,219 @@ Rcpp::Rostream<true>&  Rcpp::Rcout = Rcpp::Rcpp_cout_get();
 Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
+// bw_import_lazy_impl
+SEXP bw_import_lazy_impl(std::string bw_file, std::string chrom, int start, int end, double fill);
+RcppExport SEXP _bwimport_bw_import_lazy_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP fillSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_import_lazy_impl(bw_file, chrom, start, end, fill));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_async_submit_impl
+SEXP bw_async_submit_impl(std::string bw_file, std::string chrom, int start, int end, double fill, std::string format);
+RcppExport SEXP _bwimport_bw_async_submit_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP fillSEXP, SEXP formatSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< std::string >::type format(formatSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_async_submit_impl(bw_file, chrom, start, end, fill, format));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_prefetch_submit_impl
+SEXP bw_prefetch_submit_impl(std::string bw_file, std::vector<std::string> chroms, std::vector<int> starts, std::vector<int> ends, double budget, double cache_size);
+RcppExport SEXP _bwimport_bw_prefetch_submit_impl(SEXP bw_fileSEXP, SEXP chromsSEXP, SEXP startsSEXP, SEXP endsSEXP, SEXP budgetSEXP, SEXP cache_sizeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type starts(startsSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type ends(endsSEXP);
+    Rcpp::traits::input_parameter< double >::type budget(budgetSEXP);
+    Rcpp::traits::input_parameter< double >::type cache_size(cache_sizeSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_prefetch_submit_impl(bw_file, chroms, starts, ends, budget, cache_size));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_async_status_impl
+CharacterVector bw_async_status_impl(List handles);
+RcppExport SEXP _bwimport_bw_async_status_impl(SEXP handlesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type handles(handlesSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_async_status_impl(handles));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_async_wait_impl
+bool bw_async_wait_impl(List handles, double timeout);
+RcppExport SEXP _bwimport_bw_async_wait_impl(SEXP handlesSEXP, SEXP timeoutSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type handles(handlesSEXP);
+    Rcpp::traits::input_parameter< double >::type timeout(timeoutSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_async_wait_impl(handles, timeout));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_async_value_impl
+SEXP bw_async_value_impl(SEXP handle);
+RcppExport SEXP _bwimport_bw_async_value_impl(SEXP handleSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type handle(handleSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_async_value_impl(handle));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_async_cancel_impl
+void bw_async_cancel_impl(List handles);
+RcppExport SEXP _bwimport_bw_async_cancel_impl(SEXP handlesSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type handles(handlesSEXP);
+    bw_async_cancel_impl(handles);
+    return R_NilValue;
+END_RCPP
+}
+// bw_bed_summary_file_impl
+List bw_bed_summary_file_impl(std::string bw_file, std::string bed_file, int threads);
+RcppExport SEXP _bwimport_bw_bed_summary_file_impl(SEXP bw_fileSEXP, SEXP bed_fileSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type bed_file(bed_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_bed_summary_file_impl(bw_file, bed_file, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_bed_summary_impl
+List bw_bed_summary_impl(std::string bw_file, std::vector<std::string> chroms, IntegerVector starts, IntegerVector ends, int threads);
+RcppExport SEXP _bwimport_bw_bed_summary_impl(SEXP bw_fileSEXP, SEXP chromsSEXP, SEXP startsSEXP, SEXP endsSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type starts(startsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type ends(endsSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_bed_summary_impl(bw_file, chroms, starts, ends, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_summary_matrix_impl
+NumericMatrix bw_summary_matrix_impl(std::vector<std::string> bw_files, std::vector<std::string> chroms, IntegerVector starts, IntegerVector ends, std::string bed_file, std::string stat, int threads);
+RcppExport SEXP _bwimport_bw_summary_matrix_impl(SEXP bw_filesSEXP, SEXP chromsSEXP, SEXP startsSEXP, SEXP endsSEXP, SEXP bed_fileSEXP, SEXP statSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type bw_files(bw_filesSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type starts(startsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type ends(endsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type bed_file(bed_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type stat(statSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_summary_matrix_impl(bw_files, chroms, starts, ends, bed_file, stat, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_combine_impl
+SEXP bw_combine_impl(std::vector<std::string> bw_files, std::vector<std::string> control_files, std::string chrom, int start, int end, std::string op, double pseudocount, double fill, std::string format, int nbins);
+RcppExport SEXP _bwimport_bw_combine_impl(SEXP bw_filesSEXP, SEXP control_filesSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP opSEXP, SEXP pseudocountSEXP, SEXP fillSEXP, SEXP formatSEXP, SEXP nbinsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type bw_files(bw_filesSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type control_files(control_filesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< std::string >::type op(opSEXP);
+    Rcpp::traits::input_parameter< double >::type pseudocount(pseudocountSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< std::string >::type format(formatSEXP);
+    Rcpp::traits::input_parameter< int >::type nbins(nbinsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_combine_impl(bw_files, control_files, chrom, start, end, op, pseudocount, fill, format, nbins));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_correlation_impl
+NumericMatrix bw_correlation_impl(std::vector<std::string> bw_files, int bin_size, std::string method, std::string stat, Nullable<CharacterVector> chroms, double fill, bool skip_zeros, double tolerance, int threads);
+RcppExport SEXP _bwimport_bw_correlation_impl(SEXP bw_filesSEXP, SEXP bin_sizeSEXP, SEXP methodSEXP, SEXP statSEXP, SEXP chromsSEXP, SEXP fillSEXP, SEXP skip_zerosSEXP, SEXP toleranceSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type bw_files(bw_filesSEXP);
+    Rcpp::traits::input_parameter< int >::type bin_size(bin_sizeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< std::string >::type stat(statSEXP);
+    Rcpp::traits::input_parameter< Nullable<CharacterVector> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< bool >::type skip_zeros(skip_zerosSEXP);
+    Rcpp::traits::input_parameter< double >::type tolerance(toleranceSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_correlation_impl(bw_files, bin_size, method, stat, chroms, fill, skip_zeros, tolerance, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_distribution_impl
+List bw_distribution_impl(std::string bw_file, Nullable<CharacterVector> chroms, int start, int end, NumericVector breaks, NumericVector probs, bool approx, int level);
+RcppExport SEXP _bwimport_bw_distribution_impl(SEXP bw_fileSEXP, SEXP chromsSEXP, SEXP startSEXP, SEXP endSEXP, SEXP breaksSEXP, SEXP probsSEXP, SEXP approxSEXP, SEXP levelSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< Nullable<CharacterVector> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type breaks(breaksSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type probs(probsSEXP);
+    Rcpp::traits::input_parameter< bool >::type approx(approxSEXP);
+    Rcpp::traits::input_parameter< int >::type level(levelSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_distribution_impl(bw_file, chroms, start, end, breaks, probs, approx, level));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_downsample_impl
+List bw_downsample_impl(std::string bw_file, std::string chrom, int start, int end, int pixels, std::string method, double fill);
+RcppExport SEXP _bwimport_bw_downsample_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP pixelsSEXP, SEXP methodSEXP, SEXP fillSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< int >::type pixels(pixelsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_downsample_impl(bw_file, chrom, start, end, pixels, method, fill));
+    return rcpp_result_gen;
+END_RCPP
+}
 // bw_import_impl
-NumericVector bw_import_impl(std::string bw_file, std::string chrom, int start, int end);
-RcppExport SEXP _bwimport_bw_import_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP) {
+NumericVector bw_import_impl(std::string bw_file, std::string chrom, int start, int end, double fill, int threads);
+RcppExport SEXP _bwimport_bw_import_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP fillSEXP, SEXP threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -20,7 +230,39 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
     Rcpp::traits::input_parameter< int >::type start(startSEXP);
     Rcpp::traits::input_parameter< int >::type end(endSEXP);
-    rcpp_result_gen = Rcpp::wrap(bw_import_impl(bw_file, chrom, start, end));
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_import_impl(bw_file, chrom, start, end, fill, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_import_rle_impl
+List bw_import_rle_impl(std::string bw_file, std::string chrom, int start, int end, double fill);
+RcppExport SEXP _bwimport_bw_import_rle_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP fillSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_import_rle_impl(bw_file, chrom, start, end, fill));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_import_intervals_impl
+List bw_import_intervals_impl(std::string bw_file, std::string chrom, int start, int end, double fill);
+RcppExport SEXP _bwimport_bw_import_intervals_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP fillSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_import_intervals_impl(bw_file, chrom, start, end, fill));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -33,14 +275,222 @@ BEGIN_RCPP
     return R_NilValue;
 END_RCPP
 }
+// bw_import_matrix_impl
+NumericMatrix bw_import_matrix_impl(std::vector<std::string> bw_files, std::string chrom, int start, int end, double fill, int threads);
+RcppExport SEXP _bwimport_bw_import_matrix_impl(SEXP bw_filesSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP fillSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type bw_files(bw_filesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_import_matrix_impl(bw_files, chrom, start, end, fill, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_values_at_impl
+NumericVector bw_values_at_impl(std::string bw_file, std::vector<std::string> chroms, IntegerVector positions, double fill, int threads);
+RcppExport SEXP _bwimport_bw_values_at_impl(SEXP bw_fileSEXP, SEXP chromsSEXP, SEXP positionsSEXP, SEXP fillSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type positions(positionsSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_values_at_impl(bw_file, chroms, positions, fill, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_import_progressive_impl
+NumericVector bw_import_progressive_impl(std::string bw_file, std::string chrom, int start, int end, int pixels, double deadline_ms, Nullable<Function> on_coarse);
+RcppExport SEXP _bwimport_bw_import_progressive_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP pixelsSEXP, SEXP deadline_msSEXP, SEXP on_coarseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< int >::type pixels(pixelsSEXP);
+    Rcpp::traits::input_parameter< double >::type deadline_ms(deadline_msSEXP);
+    Rcpp::traits::input_parameter< Nullable<Function> >::type on_coarse(on_coarseSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_import_progressive_impl(bw_file, chrom, start, end, pixels, deadline_ms, on_coarse));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_region_matrix_impl
+NumericMatrix bw_region_matrix_impl(std::string bw_file, std::vector<std::string> chroms, IntegerVector starts, IntegerVector ends, std::vector<std::string> strands, std::string mode, std::string reference, int upstream, int downstream, int bin_size, int body_bins, std::string stat, double fill, int threads);
+RcppExport SEXP _bwimport_bw_region_matrix_impl(SEXP bw_fileSEXP, SEXP chromsSEXP, SEXP startsSEXP, SEXP endsSEXP, SEXP strandsSEXP, SEXP modeSEXP, SEXP referenceSEXP, SEXP upstreamSEXP, SEXP downstreamSEXP, SEXP bin_sizeSEXP, SEXP body_binsSEXP, SEXP statSEXP, SEXP fillSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type starts(startsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type ends(endsSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type strands(strandsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type mode(modeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< int >::type upstream(upstreamSEXP);
+    Rcpp::traits::input_parameter< int >::type downstream(downstreamSEXP);
+    Rcpp::traits::input_parameter< int >::type bin_size(bin_sizeSEXP);
+    Rcpp::traits::input_parameter< int >::type body_bins(body_binsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type stat(statSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_region_matrix_impl(bw_file, chroms, starts, ends, strands, mode, reference, upstream, downstream, bin_size, body_bins, stat, fill, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_metagene_impl
+List bw_metagene_impl(std::string bw_file, std::vector<std::string> chroms, IntegerVector starts, IntegerVector ends, std::vector<std::string> strands, IntegerVector groups, int n_groups, std::string mode, std::string reference, int upstream, int downstream, int bin_size, int body_bins, std::string stat, double fill, int threads);
+RcppExport SEXP _bwimport_bw_metagene_impl(SEXP bw_fileSEXP, SEXP chromsSEXP, SEXP startsSEXP, SEXP endsSEXP, SEXP strandsSEXP, SEXP groupsSEXP, SEXP n_groupsSEXP, SEXP modeSEXP, SEXP referenceSEXP, SEXP upstreamSEXP, SEXP downstreamSEXP, SEXP bin_sizeSEXP, SEXP body_binsSEXP, SEXP statSEXP, SEXP fillSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type starts(startsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type ends(endsSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type strands(strandsSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type groups(groupsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_groups(n_groupsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type mode(modeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type reference(referenceSEXP);
+    Rcpp::traits::input_parameter< int >::type upstream(upstreamSEXP);
+    Rcpp::traits::input_parameter< int >::type downstream(downstreamSEXP);
+    Rcpp::traits::input_parameter< int >::type bin_size(bin_sizeSEXP);
+    Rcpp::traits::input_parameter< int >::type body_bins(body_binsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type stat(statSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_metagene_impl(bw_file, chroms, starts, ends, strands, groups, n_groups, mode, reference, upstream, downstream, bin_size, body_bins, stat, fill, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_scan_threshold_impl
+List bw_scan_threshold_impl(std::string bw_file, double threshold, Nullable<CharacterVector> chroms, int merge_gap, int min_length, int level);
+RcppExport SEXP _bwimport_bw_scan_threshold_impl(SEXP bw_fileSEXP, SEXP thresholdSEXP, SEXP chromsSEXP, SEXP merge_gapSEXP, SEXP min_lengthSEXP, SEXP levelSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< double >::type threshold(thresholdSEXP);
+    Rcpp::traits::input_parameter< Nullable<CharacterVector> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< int >::type merge_gap(merge_gapSEXP);
+    Rcpp::traits::input_parameter< int >::type min_length(min_lengthSEXP);
+    Rcpp::traits::input_parameter< int >::type level(levelSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_scan_threshold_impl(bw_file, threshold, chroms, merge_gap, min_length, level));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_import_smooth_impl
+NumericVector bw_import_smooth_impl(std::string bw_file, std::string chrom, int start, int end, double fill, std::string kernel, int width);
+RcppExport SEXP _bwimport_bw_import_smooth_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP fillSEXP, SEXP kernelSEXP, SEXP widthSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< std::string >::type kernel(kernelSEXP);
+    Rcpp::traits::input_parameter< int >::type width(widthSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_import_smooth_impl(bw_file, chrom, start, end, fill, kernel, width));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_stats_impl
+NumericVector bw_stats_impl(std::string bw_file, std::string chrom, int start, int end, int nbins, std::string type, double tolerance);
+RcppExport SEXP _bwimport_bw_stats_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP nbinsSEXP, SEXP typeSEXP, SEXP toleranceSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< int >::type nbins(nbinsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type type(typeSEXP);
+    Rcpp::traits::input_parameter< double >::type tolerance(toleranceSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_stats_impl(bw_file, chrom, start, end, nbins, type, tolerance));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_tile_impl
+List bw_tile_impl(std::string bw_file, int width, std::string type, Nullable<CharacterVector> chroms, double tolerance, int threads);
+RcppExport SEXP _bwimport_bw_tile_impl(SEXP bw_fileSEXP, SEXP widthSEXP, SEXP typeSEXP, SEXP chromsSEXP, SEXP toleranceSEXP, SEXP threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type width(widthSEXP);
+    Rcpp::traits::input_parameter< std::string >::type type(typeSEXP);
+    Rcpp::traits::input_parameter< Nullable<CharacterVector> >::type chroms(chromsSEXP);
+    Rcpp::traits::input_parameter< double >::type tolerance(toleranceSEXP);
+    Rcpp::traits::input_parameter< int >::type threads(threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_tile_impl(bw_file, width, type, chroms, tolerance, threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bw_import_typed_impl
+SEXP bw_import_typed_impl(std::string bw_file, std::string chrom, int start, int end, double fill, std::string type);
+RcppExport SEXP _bwimport_bw_import_typed_impl(SEXP bw_fileSEXP, SEXP chromSEXP, SEXP startSEXP, SEXP endSEXP, SEXP fillSEXP, SEXP typeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type bw_file(bw_fileSEXP);
+    Rcpp::traits::input_parameter< std::string >::type chrom(chromSEXP);
+    Rcpp::traits::input_parameter< int >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type end(endSEXP);
+    Rcpp::traits::input_parameter< double >::type fill(fillSEXP);
+    Rcpp::traits::input_parameter< std::string >::type type(typeSEXP);
+    rcpp_result_gen = Rcpp::wrap(bw_import_typed_impl(bw_file, chrom, start, end, fill, type));
+    return rcpp_result_gen;
+END_RCPP
+}
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_bwimport_bw_import_impl", (DL_FUNC) &_bwimport_bw_import_impl, 4},
+    {"_bwimport_bw_import_lazy_impl", (DL_FUNC) &_bwimport_bw_import_lazy_impl, 5},
+    {"_bwimport_bw_async_submit_impl", (DL_FUNC) &_bwimport_bw_async_submit_impl, 6},
+    {"_bwimport_bw_prefetch_submit_impl", (DL_FUNC) &_bwimport_bw_prefetch_submit_impl, 6},
+    {"_bwimport_bw_async_status_impl", (DL_FUNC) &_bwimport_bw_async_status_impl, 1},
+    {"_bwimport_bw_async_wait_impl", (DL_FUNC) &_bwimport_bw_async_wait_impl, 2},
+    {"_bwimport_bw_async_value_impl", (DL_FUNC) &_bwimport_bw_async_value_impl, 1},
+    {"_bwimport_bw_async_cancel_impl", (DL_FUNC) &_bwimport_bw_async_cancel_impl, 1},
+    {"_bwimport_bw_bed_summary_file_impl", (DL_FUNC) &_bwimport_bw_bed_summary_file_impl, 3},
+    {"_bwimport_bw_bed_summary_impl", (DL_FUNC) &_bwimport_bw_bed_summary_impl, 5},
+    {"_bwimport_bw_summary_matrix_impl", (DL_FUNC) &_bwimport_bw_summary_matrix_impl, 7},
+    {"_bwimport_bw_combine_impl", (DL_FUNC) &_bwimport_bw_combine_impl, 10},
+    {"_bwimport_bw_correlation_impl", (DL_FUNC) &_bwimport_bw_correlation_impl, 9},
+    {"_bwimport_bw_distribution_impl", (DL_FUNC) &_bwimport_bw_distribution_impl, 8},
+    {"_bwimport_bw_downsample_impl", (DL_FUNC) &_bwimport_bw_downsample_impl, 7},
+    {"_bwimport_bw_import_impl", (DL_FUNC) &_bwimport_bw_import_impl, 6},
+    {"_bwimport_bw_import_rle_impl", (DL_FUNC) &_bwimport_bw_import_rle_impl, 5},
+    {"_bwimport_bw_import_intervals_impl", (DL_FUNC) &_bwimport_bw_import_intervals_impl, 5},
     {"_bwimport_bw_cleanup", (DL_FUNC) &_bwimport_bw_cleanup, 0},
+    {"_bwimport_bw_import_matrix_impl", (DL_FUNC) &_bwimport_bw_import_matrix_impl, 6},
+    {"_bwimport_bw_values_at_impl", (DL_FUNC) &_bwimport_bw_values_at_impl, 5},
+    {"_bwimport_bw_import_progressive_impl", (DL_FUNC) &_bwimport_bw_import_progressive_impl, 7},
+    {"_bwimport_bw_region_matrix_impl", (DL_FUNC) &_bwimport_bw_region_matrix_impl, 14},
+    {"_bwimport_bw_metagene_impl", (DL_FUNC) &_bwimport_bw_metagene_impl, 16},
+    {"_bwimport_bw_scan_threshold_impl", (DL_FUNC) &_bwimport_bw_scan_threshold_impl, 6},
+    {"_bwimport_bw_import_smooth_impl", (DL_FUNC) &_bwimport_bw_import_smooth_impl, 7},
+    {"_bwimport_bw_stats_impl", (DL_FUNC) &_bwimport_bw_stats_impl, 7},
+    {"_bwimport_bw_tile_impl", (DL_FUNC) &_bwimport_bw_tile_impl, 6},
+    {"_bwimport_bw_import_typed_impl", (DL_FUNC) &_bwimport_bw_import_typed_impl, 6},
     {NULL, NULL, 0}
 };
 
+void bw_altrep_init(DllInfo* dll);
 RcppExport void R_init_bwimport(DllInfo *dll) {
     R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
     R_useDynamicSymbols(dll, FALSE);
+    bw_altrep_init(dll);
 }
@@ -257,6 +257,52 @@ typedef struct {
     void *data; /**<Points to either intervals or entries. If there are no further intervals/entries, then this is NULL. Use this to test for whether to continue iterating.*/
 } bwOverlapIterator_t;
 
+/*!
+ * @brief The plan chosen by bwPlanStats() for a statistics query.
+ *
+ * Each candidate (every zoom level fine enough for the requested bins, then the full resolution data) is costed by walking its index over the query range and summing the on-disk size of the overlapping blocks. The cheapest candidate wins. The full resolution walk stops once it reads more than the best zoom level, so its counts may be lower bounds.
+ */
+typedef struct {
+    int32_t level; /**<The zoom level to use, or -1 for full resolution data.*/
+    uint32_t resolution; /**<The bases summarised per zoom record at that level (0 for full resolution data).*/
+    uint64_t nBlocks; /**<The number of data blocks the chosen plan reads.*/
+    uint64_t nBytes; /**<The summed on-disk size of those blocks.*/
+    uint64_t fullBlocks; /**<The number of blocks the full resolution data would need (a lower bound unless fullComplete).*/
+    uint64_t fullBytes; /**<The summed on-disk size of those full resolution blocks (likewise).*/
+    uint16_t nCandidates; /**<The number of plans that were costed, including full resolution.*/
+    uint8_t fullComplete; /**<1 if the full resolution index was walked to the end, 0 if costing stopped once a zoom level was cheaper.*/
+} bwQueryPlan_t;
+
+/*!
+ * @brief Zoom level records overlapping an interval, as returned by bwGetZoomRecords().
+ *
+ * Each record summarises the bases in [start, end) at a given zoom level. Only nBases of those are actually covered by data, so the mean is sum/nBases.
+ */
+typedef struct {
+    uint32_t l; /**<Number of records held*/
+    uint32_t m; /**<Maximum number of records the struct can hold*/
+    uint32_t *start; /**<The start positions (0-based half open)*/
+    uint32_t *end; /**<The end positions (0-based half open)*/
+    uint32_t *nBases; /**<The number of bases with data in each record*/
+    float *min; /**<The minimum value in each record*/
+    float *max; /**<The maximum value in each record*/
+    float *sum; /**<The sum of the per-base values in each record*/
+    float *sumsq; /**<The sum of the squared per-base values in each record*/
+} bwZoomRecords_t;
+
+/*!
+ * @brief Full resolution data blocks on one chromosome with the span each covers, as returned by bwGetBlockList().
+ * Blocks are in index order, which is sorted by start. A block that continues onto a neighbouring chromosome has its span clipped to [0, 2^32-1) on this one.
+ */
+typedef struct {
+    uint64_t n; /**<Number of blocks held*/
+    uint64_t m; /**<Maximum number of blocks the struct can hold*/
+    uint32_t *start; /**<The first base covered by each block (0-based)*/
+    uint32_t *end; /**<One past the last base covered by each block*/
+    uint64_t *offset; /**<The on-disk offset of each block*/
+    uint64_t *size; /**<The on-disk size of each block (in bytes)*/
+} bwBlockList_t;
+
 /*!
  * @brief Initializes curl and global variables. This *MUST* be called before other functions (at least if you want to connect to remote files).
  * For remote file, curl must be initialized and regions of a file read into an internal buffer. If the buffer is too small then an excessive number of connections will be made. If the buffer is too large than more data than required is fetched. 128KiB is likely sufficient for most needs.
@@ -272,6 +318,21 @@ int bwInit(size_t bufSize);
  */
 void bwCleanup(void);
 
+/*!
+ * @brief Callbacks through which a cache can serve the reads made on open files (index nodes and data blocks, see bwReadAt()).
+ */
+typedef struct {
+    int (*lookup)(const bigWigFile_t *fp, void *buf, size_t sz, size_t pos); /**<Fill buf with the sz bytes at pos of fp's file and return 0, or return -1 if they aren't all cached.*/
+    void (*store)(const bigWigFile_t *fp, const void *buf, size_t sz, size_t pos); /**<Offered every range read from a file after a lookup miss. buf is only valid during the call.*/
+} bwReadCache_t;
+
+/*!
+ * @brief Put a cache in front of the reads made on open files, or remove it (NULL).
+ * The callbacks are called from whichever thread reads, so they must be thread-safe. `fp->URL->fname` identifies the file and `fp->URL->version` (with the header in `fp->hdr`) the version of it being read. The cache must stay valid until it is removed, and must not be removed while files are being read.
+ * @param cache The callbacks, or NULL.
+ */
+void bwSetReadCache(const bwReadCache_t *cache);
+
 /*!
  * @brief Determine if a file is a bigWig file.
  * This function will quickly check either local or remote files to determine if they appear to be valid bigWig files. This can be determined by reading the first 4 bytes of the file.
@@ -449,7 +510,7 @@ bwOverlappingIntervals_t *bwGetValues(bigWigFile_t *fp, const char *chrom, uint3
 
 /*!
  * @brief Determines per-interval bigWig statistics
- * Can determine mean/min/max/coverage/standard deviation of values in one or more intervals in a bigWig file. You can optionally give it an interval and ask for values from X number of sub-intervals.
+ * Can determine mean/min/max/coverage/standard deviation of values in one or more intervals in a bigWig file. You can optionally give it an interval and ask for values from X number of sub-intervals. Zoom levels are used as in Kent's library (the coarsest one summarising at most half a bin), without costing them; see bwStatsPlanned() for a planned query.
  * @param fp The file from which to extract statistics.
  * @param chrom A valid chromosome name.
  * @param start The start position of the interval. This is 0-based half open, so 0 is the first base.
@@ -475,6 +536,116 @@ double *bwStats(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t en
 */
 double *bwStatsFromFull(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, uint32_t nBins, enum bwStatsType type);
 
+/*!
+ * @brief Chooses between full resolution data and the zoom levels for a statistics query
+ * A zoom level is a candidate if it summarises at most `tolerance * (end-start)/nBins` bases per record. Each candidate, and then the full resolution data, is costed from its index (number of overlapping blocks and their on-disk size) and the one reading the fewest bytes is chosen. Ties go to the finer resolution. The full resolution index is only walked as far as it takes to exceed the best zoom level's bytes, so a costly region doesn't load the whole index just to lose.
+ * @param fp The file to plan the query against.
+ * @param tid The chromosome ID, as returned by bwGetTid().
+ * @param start The start position of the interval (0-based half open).
+ * @param end The end position of the interval (0-based half open).
+ * @param nBins The number of bins the interval will be split into.
+ * @param tolerance The largest acceptable zoom resolution, as a fraction of the bin size. 0.5 mirrors bwStats(), 0 or less disables zoom levels.
+ * @param plan Filled with the chosen plan.
+ * @return 0 on success and 1 on error (e.g., an index couldn't be read).
+ * @see bwQueryPlan_t
+ */
+int bwPlanStats(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end, uint32_t nBins, double tolerance, bwQueryPlan_t *plan);
+
+/*!
+ * @brief Like bwStats(), but the zoom level is chosen by bwPlanStats()
+ * @param fp The file from which to extract statistics.
+ * @param chrom A valid chromosome name.
+ * @param start The start position of the interval (0-based half open).
+ * @param end The end position of the interval (0-based half open).
+ * @param nBins The number of bins within the interval to calculate statistics for.
+ * @param type The type of statistic.
+ * @param tolerance See bwPlanStats().
+ * @param plan If not NULL, filled with the plan that was executed.
+ * @return As for bwStats(), NULL on error.
+ */
+double *bwStatsPlanned(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, uint32_t nBins, enum bwStatsType type, double tolerance, bwQueryPlan_t *plan);
+
+/*!
+ * @brief Return the zoom records at a given level that overlap an interval
+ * This reads only the (small) zoom level blocks, so it's a cheap way to get a coarse view of a region.
+ * @param fp The file to query.
+ * @param level The zoom level (an index into fp->hdr->zoomHdrs, not its resolution).
+ * @param tid The chromosome ID, as returned by bwGetTid().
+ * @param start The start position of the interval (0-based half open).
+ * @param end The end position of the interval (0-based half open).
+ * @return NULL on error, otherwise a bwZoomRecords_t * (possibly holding no records) that must be freed with bwDestroyZoomRecords().
+ * @see bwZoomRecords_t
+ */
+bwZoomRecords_t *bwGetZoomRecords(bigWigFile_t *fp, int32_t level, uint32_t tid, uint32_t start, uint32_t end);
+
+/*!
+ * @brief Frees space allocated by bwGetZoomRecords()
+ * @param z The object to free.
+ */
+void bwDestroyZoomRecords(bwZoomRecords_t *z);
+
+/*!
+ * @brief Return the full resolution data blocks overlapping an interval, with their spans.
+ * Unlike bwGetOverlappingIntervals() nothing is read beyond the index, so callers can decide which blocks are worth decoding (see bwReadBlock()).
+ * @param fp The file to query.
+ * @param tid The chromosome ID, as returned by bwGetTid().
+ * @param start The start position of the interval (0-based half open).
+ * @param end The end position of the interval (0-based half open).
+ * @return NULL on error, otherwise a bwBlockList_t * (possibly holding no blocks) that must be freed with bwDestroyBlockList().
+ */
+bwBlockList_t *bwGetBlockList(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end);
+
+/*!
+ * @brief Decode one block of a bwBlockList_t.
+ * @param fp The file the list came from.
+ * @param blocks The block list.
+ * @param i The index of the block to decode.
+ * @param tid The chromosome ID the list was made for.
+ * @return NULL on error, otherwise the block's intervals on `tid` (possibly none), to be freed with bwDestroyOverlappingIntervals().
+ */
+bwOverlappingIntervals_t *bwReadBlock(bigWigFile_t *fp, const bwBlockList_t *blocks, uint64_t i, uint32_t tid);
+
+/*!
+ * @brief Read the on-disk bytes of blocks i .. i+n-1 of a bwBlockList_t in one read.
+ * This and bwInflateBlock() and bwDecodeBlock() are bwReadBlock() split into its I/O, inflate and decode steps, so that they can run in different threads. The blocks must lie back to back in the file (`offset[j+1] == offset[j] + size[j]`).
+ * @param fp The file the list came from.
+ * @param blocks The block list.
+ * @param i The first block to read.
+ * @param n The number of blocks.
+ * @param buf Where to put the bytes. It must be able to hold `offset[i+n-1] + size[i+n-1] - offset[i]` bytes.
+ * @return 0 on success and -1 on error.
+ */
+int bwFetchBlocks(bigWigFile_t *fp, const bwBlockList_t *blocks, uint64_t i, uint64_t n, void *buf);
+
+/*!
+ * @brief Uncompress one block read by bwFetchBlocks().
+ * Blocks of uncompressed files (`fp->hdr->bufSize == 0`) are copied as they are.
+ * @param fp The file the block came from.
+ * @param in The block's on-disk bytes.
+ * @param inSize Its on-disk size (`size[i]` in the block list).
+ * @param out The output buffer, able to hold `fp->hdr->bufSize` bytes (`inSize` for uncompressed files).
+ * @param outSize Set to the number of bytes in `out`.
+ * @return 0 on success and -1 on error.
+ */
+int bwInflateBlock(const bigWigFile_t *fp, const void *in, uint64_t inSize, void *out, uint64_t *outSize);
+
+/*!
+ * @brief Decode one uncompressed block.
+ * @param buf The block, as produced by bwInflateBlock().
+ * @param size Its size in bytes.
+ * @param tid The chromosome ID to keep intervals for.
+ * @param start The start of the interval of interest (0-based half open), e.g. `start[i]` in the block list.
+ * @param end The end of the interval of interest (0-based half open).
+ * @return NULL on error (including a truncated block), otherwise the block's intervals on `tid` overlapping [start, end), to be freed with bwDestroyOverlappingIntervals().
+ */
+bwOverlappingIntervals_t *bwDecodeBlock(void *buf, uint64_t size, uint32_t tid, uint32_t start, uint32_t end);
+
+/*!
+ * @brief Frees space allocated by bwGetBlockList()
+ * @param b The object to free.
+ */
+void bwDestroyBlockList(bwBlockList_t *b);
+
 //Writer functions
 
 /*!
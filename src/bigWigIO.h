@@ -49,7 +49,9 @@ typedef struct {
     size_t bufLen; /**<The actual size of the buffer used.*/
     enum bigWigFile_type_enum type; /**<The connection type*/
     int isCompressed; /**<1 if the file is compressed, otherwise 0*/
-    const char *fname; /**<Only needed for remote connections. The original URL/filename requested, since we need to make multiple connections.*/
+    const char *fname; /**<A copy of the URL/filename requested, owned by the URL_t (remote files need it to make further connections).*/
+    void *spare; /**<Remote files only: idle curl handles lent out by urlReadAt() and its read-ahead windows (see io.c).*/
+    char version[160]; /**<What identifies this version of the file, set by urlOpen() for local files (size and modification time) and by the first reply for remote ones (its ETag, Last-Modified and Content-Range headers). Empty if unknown.*/
 } URL_t;
 
 /*!
@@ -67,6 +69,17 @@ typedef struct {
  */
 size_t urlRead(URL_t *URL, void *buf, size_t bufSize);
 
+/*!
+ *  @brief Reads data from a given position without using or moving the file position.
+ *  Unlike urlSeek() followed by urlRead() this doesn't move the file position, so any number of threads may call it on the same URL_t at once. Local files are read with `pread` (`ReadFile` with an offset on Windows), remote ones with a range request on a curl handle borrowed for the duration of the call. A remote read smaller than the internal buffer size asks for that much instead and keeps the reply in one of a few read-ahead windows, so that nearby reads (the next index node or block) need no request; reads that the open-time buffer or a window hold are served from memory.
+ *  @param URL A URL_t * pointing to a valid opened file or remote URL.
+ *  @param buf The buffer in memory that you would like filled. It must be able to hold bufSize bytes!
+ *  @param bufSize The number of bytes to transfer to buf.
+ *  @param pos The position in the file to read from.
+ *  @return Returns the number of bytes stored in buf, which should be bufSize on success and something else on error.
+ */
+size_t urlReadAt(URL_t *URL, void *buf, size_t bufSize, size_t pos);
+
 /*!
  *  @brief Seeks to a given position in a local or remote file.
  * 
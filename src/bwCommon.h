@@ -26,6 +26,18 @@ int bwSetPos(bigWigFile_t *fp, size_t pos);
  */
 size_t bwRead(void *data, size_t sz, size_t nmemb, bigWigFile_t *fp);
 
+/*!
+ * @brief A positional version of `bwRead`.
+ * Reads sz bytes starting at pos without using or moving the file position indicator, so several threads can read from the same bigWigFile_t at once. Everything run on an open file after bwOpen()/bbOpen() reads this way. Reads go through the cache set with bwSetReadCache(), if any.
+ * @param data An allocated memory block big enough to hold the data.
+ * @param sz The number of bytes to read.
+ * @param pos The position within the file to read from.
+ * @param fp The bigWigFile_t * from which to copy the data.
+ * @see urlReadAt
+ * @return 0 on success and -1 on error (including a short read).
+ */
+int bwReadAt(void *data, size_t sz, size_t pos, bigWigFile_t *fp);
+
 /*!
  * @brief Determine what the file position indicator say.
  * This is equivalent to `ftell` for local or remote files.
@@ -56,8 +68,22 @@ void bwDestroyIndexNode(bwRTreeNode_t *node);
  */
 void bwDestroyIndex(bwRTree_t *idx);
 
+/*!
+ * @brief Returns the index held in *slot, reading it first if it's still NULL.
+ * Index parts read on demand (the data index, zoom level indices and R-tree nodes below their root) are published with a compare-and-swap once fully read, so threads sharing a bigWigFile_t never see a half-read one. A thread that loses the race frees its copy and uses the winner's.
+ * @param fp A valid bigWigFile_t pointer
+ * @param slot Where the index is kept, e.g. `&fp->idx` or `&fp->hdr->zoomHdrs->idx[i]`.
+ * @param offset As for `bwReadIndex`.
+ * @return The index or NULL on error.
+ */
+bwRTree_t *bwLoadIndex(bigWigFile_t *fp, bwRTree_t **slot, uint64_t offset);
+
 /// @cond SKIP
+#define bwLoadPtr(slot) __atomic_load_n((slot), __ATOMIC_ACQUIRE)
+#define bwPublishPtr(slot, expected, v) __atomic_compare_exchange_n((slot), (expected), (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
 bwOverlapBlock_t *walkRTreeNodes(bigWigFile_t *bw, bwRTreeNode_t *root, uint32_t tid, uint32_t start, uint32_t end);
+//Adds the number and on-disk size of the blocks below node overlapping tid:start-end to *nBlocks and *nBytes, reading nodes in file order. Returns 0 when done, 1 on error and 2 as soon as *nBytes exceeds maxBytes (the counts are then lower bounds).
+int costRTreeNodes(bigWigFile_t *fp, bwRTreeNode_t *node, uint32_t tid, uint32_t start, uint32_t end, uint64_t maxBytes, uint64_t *nBlocks, uint64_t *nBytes);
 void destroyBWOverlapBlock(bwOverlapBlock_t *b);
 /// @endcond
 
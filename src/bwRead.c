@@ -33,6 +33,23 @@ size_t bwRead(void *data, size_t sz, size_t nmemb, bigWigFile_t *fp) {
     return nmemb;
 }
 
+//Set by bwSetReadCache(), read by every bwReadAt()
+static const bwReadCache_t *readCache = NULL;
+
+void bwSetReadCache(const bwReadCache_t *cache) {
+    __atomic_store_n(&readCache, cache, __ATOMIC_RELEASE);
+}
+
+//Reads sz bytes at pos, leaving the file position alone, so threads may share fp
+//Returns 0 on success and -1 on error
+int bwReadAt(void *data, size_t sz, size_t pos, bigWigFile_t *fp) {
+    const bwReadCache_t *cache = bwLoadPtr(&readCache);
+    if(cache && cache->lookup(fp, data, sz, pos) == 0) return 0;
+    if(urlReadAt(fp->URL, data, sz, pos) != sz) return -1;
+    if(cache) cache->store(fp, data, sz, pos);
+    return 0;
+}
+
 //Initializes curl and sets global variables
 //Returns 0 on success and 1 on error
 //This should be called only once and bwCleanup() must be called when finished.
@@ -320,8 +337,7 @@ char *bbGetSQL(bigWigFile_t *fp) {
     len = fp->hdr->summaryOffset - fp->hdr->sqlOffset; //This includes the NULL terminator
     o = malloc(sizeof(char) * len);
     if(!o) goto error;
-    if(bwSetPos(fp, fp->hdr->sqlOffset)) goto error;
-    if(bwRead((void*) o, len, 1, fp) != 1) goto error;
+    if(bwReadAt((void*) o, len, fp->hdr->sqlOffset, fp)) goto error;
     return o;
 
 error:
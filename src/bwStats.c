@@ -7,8 +7,23 @@
 #include <string.h>
 #include "bw_quiet.h"
 
-//Returns -1 if there are no applicable levels, otherwise an integer indicating the most appropriate level.
-//Like Kent's library, this divides the desired bin size by 2 to minimize the effect of blocks overlapping multiple bins
+//Returns the index for a zoom level, reading it in if needed. Returns NULL on error.
+static bwRTree_t *getZoomIndex(bigWigFile_t *fp, int32_t level) {
+    bwRTree_t *idx = bwLoadIndex(fp, &(fp->hdr->zoomHdrs->idx[level]), fp->hdr->zoomHdrs->indexOffset[level]);
+    errno = 0; //Sometimes libCurls sets and then doesn't unset errno on errors
+    return idx;
+}
+
+//Sums the number and on-disk size of the blocks in idx overlapping the interval, giving up once the bytes exceed maxBytes
+//Returns 0 on success, 1 on error and 2 if it gave up
+static int blockCost(bigWigFile_t *fp, bwRTree_t *idx, uint32_t tid, uint32_t start, uint32_t end, uint64_t maxBytes, uint64_t *nBlocks, uint64_t *nBytes) {
+    *nBlocks = 0;
+    *nBytes = 0;
+    if(!idx || !idx->root) return 1;
+    return costRTreeNodes(fp, idx->root, tid, start, end, maxBytes, nBlocks, nBytes);
+}
+
+//The coarsest zoom level summarising at most half a bin, as in Kent's library. Returns -1 if there's none.
 static int32_t determineZoomLevel(const bigWigFile_t *fp, int basesPerBin) {
     int32_t out = -1;
     int64_t diff;
@@ -26,6 +41,52 @@ static int32_t determineZoomLevel(const bigWigFile_t *fp, int basesPerBin) {
     return out;
 }
 
+//Unlike Kent's library, which takes the coarsest level at most half the bin size, this costs every level within the tolerance (and the full resolution data) by the bytes it would read.
+//The zoom levels go first: their indices are small, and the cheapest of them bounds the walk over the (much larger) full resolution index, which stops as soon as it can no longer win.
+int bwPlanStats(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end, uint32_t nBins, double tolerance, bwQueryPlan_t *plan) {
+    uint64_t nBlocks, nBytes, maxBytes = (uint64_t) -1;
+    double maxRes = tolerance * ((double)(end-start))/((int) nBins);
+    bwRTree_t *idx;
+    uint16_t i;
+    int rv;
+
+    memset(plan, 0, sizeof(bwQueryPlan_t));
+    plan->level = -1;
+
+    for(i=0; i<fp->hdr->nLevels; i++) {
+        if(fp->hdr->zoomHdrs->level[i] > maxRes) continue;
+        idx = getZoomIndex(fp, i);
+        if(!idx) return 1;
+        if(blockCost(fp, idx, tid, start, end, (uint64_t) -1, &nBlocks, &nBytes)) return 1;
+        plan->nCandidates++;
+
+        if(plan->level == -1 || nBytes < plan->nBytes || (nBytes == plan->nBytes && fp->hdr->zoomHdrs->level[i] < plan->resolution)) {
+            plan->level = i;
+            plan->resolution = fp->hdr->zoomHdrs->level[i];
+            plan->nBlocks = nBlocks;
+            plan->nBytes = nBytes;
+        }
+    }
+
+    //Full resolution data wins ties, so it only loses once it reads more than the best zoom level
+    if(plan->level != -1) maxBytes = plan->nBytes;
+    idx = bwLoadIndex(fp, &(fp->idx), 0);
+    if(!idx) return 1;
+    rv = blockCost(fp, idx, tid, start, end, maxBytes, &(plan->fullBlocks), &(plan->fullBytes));
+    if(rv == 1) return 1;
+    plan->nCandidates++;
+    plan->fullComplete = rv == 0;
+
+    if(plan->fullComplete) {
+        plan->level = -1;
+        plan->resolution = 0;
+        plan->nBlocks = plan->fullBlocks;
+        plan->nBytes = plan->fullBytes;
+    }
+
+    return 0;
+}
+
 /// @cond SKIP
 struct val_t {
     uint32_t nBases;
@@ -75,8 +136,6 @@ static struct vals_t *getVals(bigWigFile_t *fp, bwOverlapBlock_t *o, int i, uint
     }
     sz = 0; //This is now the size of the compressed buffer
 
-    if(bwSetPos(fp, o->offset[i])) goto error;
-
     vals = calloc(1,sizeof(struct vals_t));
     if(!vals) goto error;
 
@@ -86,7 +145,7 @@ static struct vals_t *getVals(bigWigFile_t *fp, bwOverlapBlock_t *o, int i, uint
     if(sz < o->size[i]) compBuf = malloc(o->size[i]);
     if(!compBuf) goto error;
 
-    if(bwRead(compBuf, o->size[i], 1, fp) != 1) goto error;
+    if(bwReadAt(compBuf, o->size[i], o->offset[i], fp)) goto error;
     if(compressed) {
         sz = fp->hdr->bufSize;
         rv = uncompress(buf, &sz, compBuf, o->size[i]);
@@ -425,19 +484,16 @@ static double *bwStatsFromZoom(bigWigFile_t *fp, int32_t level, uint32_t tid, ui
     bwOverlapBlock_t *blocks = NULL;
     double *output = NULL;
     uint32_t pos = start, i, end2;
+    bwRTree_t *idx = getZoomIndex(fp, level);
 
-    if(!fp->hdr->zoomHdrs->idx[level]) {
-        fp->hdr->zoomHdrs->idx[level] = bwReadIndex(fp, fp->hdr->zoomHdrs->indexOffset[level]);
-        if(!fp->hdr->zoomHdrs->idx[level]) return NULL;
-    }
-    errno = 0; //Sometimes libCurls sets and then doesn't unset errno on errors
+    if(!idx) return NULL;
 
     output = malloc(sizeof(double)*nBins);
     if(!output) return NULL;
 
     for(i=0, pos=start; i<nBins; i++) {
         end2 = start + ((double)(end-start)*(i+1))/((int) nBins);
-        blocks = walkRTreeNodes(fp, fp->hdr->zoomHdrs->idx[level]->root, tid, pos, end2);
+        blocks = walkRTreeNodes(fp, idx->root, tid, pos, end2);
         if(!blocks) goto error;
 
         switch(type) {
@@ -483,6 +539,122 @@ error:
     return NULL;
 }
 
+void bwDestroyZoomRecords(bwZoomRecords_t *z) {
+    if(!z) return;
+    if(z->start) free(z->start);
+    if(z->end) free(z->end);
+    if(z->nBases) free(z->nBases);
+    if(z->min) free(z->min);
+    if(z->max) free(z->max);
+    if(z->sum) free(z->sum);
+    if(z->sumsq) free(z->sumsq);
+    free(z);
+}
+
+//p points to an on-disk zoom record: tid, start, end, nBases, min, max, sum, sumsq
+//Returns 0 on success and 1 on error
+static int pushZoomRecord(bwZoomRecords_t *z, const uint32_t *p) {
+    if(z->l+1 >= z->m) {
+        //Each array is only replaced once it has grown, so z stays valid (and freeable) on failure
+        uint32_t m = z->m ? 2*z->m : 64;
+        uint32_t *u = realloc(z->start, m * sizeof(uint32_t));
+        if(!u) return 1;
+        z->start = u;
+        u = realloc(z->end, m * sizeof(uint32_t));
+        if(!u) return 1;
+        z->end = u;
+        u = realloc(z->nBases, m * sizeof(uint32_t));
+        if(!u) return 1;
+        z->nBases = u;
+        float *f = realloc(z->min, m * sizeof(float));
+        if(!f) return 1;
+        z->min = f;
+        f = realloc(z->max, m * sizeof(float));
+        if(!f) return 1;
+        z->max = f;
+        f = realloc(z->sum, m * sizeof(float));
+        if(!f) return 1;
+        z->sum = f;
+        f = realloc(z->sumsq, m * sizeof(float));
+        if(!f) return 1;
+        z->sumsq = f;
+        z->m = m;
+    }
+    z->start[z->l] = p[1];
+    z->end[z->l] = p[2];
+    z->nBases[z->l] = p[3];
+    z->min[z->l] = ((const float*) p)[4];
+    z->max[z->l] = ((const float*) p)[5];
+    z->sum[z->l] = ((const float*) p)[6];
+    z->sumsq[z->l++] = ((const float*) p)[7];
+    return 0;
+}
+
+//Returns NULL on error
+bwZoomRecords_t *bwGetZoomRecords(bigWigFile_t *fp, int32_t level, uint32_t tid, uint32_t start, uint32_t end) {
+    bwOverlapBlock_t *blocks = NULL;
+    bwZoomRecords_t *output = NULL;
+    void *buf = NULL, *compBuf = NULL, *tmp;
+    uLongf sz, compSz = 0;
+    uint64_t i;
+    uint32_t *p, *pEnd;
+    int compressed = (fp->hdr->bufSize) ? 1 : 0;
+    bwRTree_t *idx;
+
+    if(level < 0 || level >= fp->hdr->nLevels) return NULL;
+    idx = getZoomIndex(fp, level);
+    if(!idx) return NULL;
+    blocks = walkRTreeNodes(fp, idx->root, tid, start, end);
+    if(!blocks) return NULL;
+
+    output = calloc(1, sizeof(bwZoomRecords_t));
+    if(!output) goto error;
+    if(compressed) {
+        buf = malloc(fp->hdr->bufSize);
+        if(!buf) goto error;
+    }
+
+    for(i=0; i<blocks->n; i++) {
+        if(compSz < blocks->size[i]) {
+            tmp = realloc(compBuf, blocks->size[i]);
+            if(!tmp) goto error;
+            compBuf = tmp;
+            compSz = blocks->size[i];
+        }
+        if(bwReadAt(compBuf, blocks->size[i], blocks->offset[i], fp)) goto error;
+        if(compressed) {
+            sz = fp->hdr->bufSize;
+            if(uncompress(buf, &sz, compBuf, blocks->size[i]) != Z_OK) goto error;
+            p = buf;
+        } else {
+            sz = blocks->size[i];
+            p = compBuf;
+        }
+
+        //Records are 32 bytes and sorted by (tid, start) within a block
+        pEnd = p + 8*(sz/32);
+        for(; p < pEnd; p += 8) {
+            if(p[0] < tid) continue;
+            if(p[0] > tid || p[1] >= end) break;
+            if(p[2] <= start) continue;
+            if(pushZoomRecord(output, p)) goto error;
+        }
+    }
+
+    if(buf) free(buf);
+    if(compBuf) free(compBuf);
+    destroyBWOverlapBlock(blocks);
+    return output;
+
+error:
+    BW_STDERR("[bwGetZoomRecords] Got an error\n");
+    if(buf) free(buf);
+    if(compBuf) free(compBuf);
+    destroyBWOverlapBlock(blocks);
+    bwDestroyZoomRecords(output);
+    return NULL;
+}
+
 double *bwStatsFromFull(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, uint32_t nBins, enum bwStatsType type) {
     bwOverlappingIntervals_t *ints = NULL;
     double *output = malloc(sizeof(double)*nBins);
@@ -536,3 +708,16 @@ double *bwStats(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t en
     if(level == -1) return bwStatsFromFull(fp, chrom, start, end, nBins, type);
     return bwStatsFromZoom(fp, level, tid, start, end, nBins, type);
 }
+
+//As bwStats(), but with a caller-supplied zoom tolerance. If plan isn't NULL it's filled with the plan that was executed.
+double *bwStatsPlanned(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end, uint32_t nBins, enum bwStatsType type, double tolerance, bwQueryPlan_t *plan) {
+    bwQueryPlan_t local;
+    uint32_t tid = bwGetTid(fp, chrom);
+    if(tid == (uint32_t) -1) return NULL;
+    if(!plan) plan = &local;
+
+    if(bwPlanStats(fp, tid, start, end, nBins, tolerance, plan)) return NULL;
+
+    if(plan->level == -1) return bwStatsFromFull(fp, chrom, start, end, nBins, type);
+    return bwStatsFromZoom(fp, plan->level, tid, start, end, nBins, type);
+}
@@ -19,17 +19,16 @@ static uint32_t roundup(uint32_t v) {
 }
 
 //Returns the root node on success and NULL on error
+//The header is read in one go at a fixed position, so this is safe on a shared fp
 static bwRTree_t *readRTreeIdx(bigWigFile_t *fp, uint64_t offset) {
+    uint8_t buf[48];
     uint32_t magic;
     bwRTree_t *node;
 
-    if(!offset) {
-        if(bwSetPos(fp, fp->hdr->indexOffset)) return NULL;
-    } else {
-        if(bwSetPos(fp, offset)) return NULL;
-    }
+    if(!offset) offset = fp->hdr->indexOffset;
+    if(bwReadAt(buf, sizeof(buf), offset, fp)) return NULL;
 
-    if(bwRead(&magic, sizeof(uint32_t), 1, fp) != 1) return NULL;
+    memcpy(&magic, buf, sizeof(uint32_t));
     if(magic != IDX_MAGIC) {
         BW_STDERR("[readRTreeIdx] Mismatch in the magic number!\n");
         return NULL;
@@ -38,47 +37,39 @@ static bwRTree_t *readRTreeIdx(bigWigFile_t *fp, uint64_t offset) {
     node = calloc(1, sizeof(bwRTree_t));
     if(!node) return NULL;
 
-    if(bwRead(&(node->blockSize), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->nItems), sizeof(uint64_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->chrIdxStart), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->baseStart), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->chrIdxEnd), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->baseEnd), sizeof(uint32_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->idxSize), sizeof(uint64_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->nItemsPerSlot), sizeof(uint32_t), 1, fp) != 1) goto error;
-    //Padding
-    if(bwRead(&(node->blockSize), sizeof(uint32_t), 1, fp) != 1) goto error;
-    node->rootOffset = bwTell(fp);
+    memcpy(&(node->blockSize), buf + 4, sizeof(uint32_t));
+    memcpy(&(node->nItems), buf + 8, sizeof(uint64_t));
+    memcpy(&(node->chrIdxStart), buf + 16, sizeof(uint32_t));
+    memcpy(&(node->baseStart), buf + 20, sizeof(uint32_t));
+    memcpy(&(node->chrIdxEnd), buf + 24, sizeof(uint32_t));
+    memcpy(&(node->baseEnd), buf + 28, sizeof(uint32_t));
+    memcpy(&(node->idxSize), buf + 32, sizeof(uint64_t));
+    memcpy(&(node->nItemsPerSlot), buf + 40, sizeof(uint32_t));
+    //4 bytes of padding
+    node->rootOffset = offset + sizeof(buf);
 
     //For remote files, libCurl sometimes sets errno to 115 and doesn't clear it
     errno = 0;
 
     return node;
-
-error:
-    free(node);
-    return NULL;
 }
 
 //Returns a bwRTreeNode_t on success and NULL on an error
-//For the root node, set offset to 0
+//The node is read with two positional reads (its header, then all of its items), so this is safe on a shared fp
 static bwRTreeNode_t *bwGetRTreeNode(bigWigFile_t *fp, uint64_t offset) {
     bwRTreeNode_t *node = NULL;
-    uint8_t padding;
+    uint8_t hdr[4], *items = NULL, *p;
+    size_t itemSize;
     uint16_t i;
-    if(offset) {
-        if(bwSetPos(fp, offset)) return NULL;
-    } else {
-        //seek
-        if(bwSetPos(fp, fp->idx->rootOffset)) return NULL;
-    }
+
+    if(bwReadAt(hdr, sizeof(hdr), offset, fp)) return NULL;
 
     node = calloc(1, sizeof(bwRTreeNode_t));
     if(!node) return NULL;
 
-    if(bwRead(&(node->isLeaf), sizeof(uint8_t), 1, fp) != 1) goto error;
-    if(bwRead(&padding, sizeof(uint8_t), 1, fp) != 1) goto error;
-    if(bwRead(&(node->nChildren), sizeof(uint16_t), 1, fp) != 1) goto error;
+    node->isLeaf = hdr[0];
+    //hdr[1] is padding
+    memcpy(&(node->nChildren), hdr + 2, sizeof(uint16_t));
 
     node->chrIdxStart = malloc(sizeof(uint32_t)*(node->nChildren));
     if(!node->chrIdxStart) goto error;
@@ -97,20 +88,26 @@ static bwRTreeNode_t *bwGetRTreeNode(bigWigFile_t *fp, uint64_t offset) {
         node->x.child = calloc(node->nChildren, sizeof(struct bwRTreeNode_t *));
         if(!node->x.child) goto error;
     }
-    for(i=0; i<node->nChildren; i++) {
-        if(bwRead(&(node->chrIdxStart[i]), sizeof(uint32_t), 1, fp) != 1) goto error;
-        if(bwRead(&(node->baseStart[i]), sizeof(uint32_t), 1, fp) != 1) goto error;
-        if(bwRead(&(node->chrIdxEnd[i]), sizeof(uint32_t), 1, fp) != 1) goto error;
-        if(bwRead(&(node->baseEnd[i]), sizeof(uint32_t), 1, fp) != 1) goto error;
-        if(bwRead(&(node->dataOffset[i]), sizeof(uint64_t), 1, fp) != 1) goto error;
-        if(node->isLeaf) {
-            if(bwRead(&(node->x.size[i]), sizeof(uint64_t), 1, fp) != 1) goto error;
-        }
+
+    //Leaf items are chrIdxStart, baseStart, chrIdxEnd, baseEnd, dataOffset and size; non-leaf ones lack the size
+    itemSize = node->isLeaf ? 32 : 24;
+    items = malloc(itemSize * node->nChildren + 1);
+    if(!items) goto error;
+    if(bwReadAt(items, itemSize * node->nChildren, offset + sizeof(hdr), fp)) goto error;
+    for(i=0, p=items; i<node->nChildren; i++, p+=itemSize) {
+        memcpy(&(node->chrIdxStart[i]), p, sizeof(uint32_t));
+        memcpy(&(node->baseStart[i]), p + 4, sizeof(uint32_t));
+        memcpy(&(node->chrIdxEnd[i]), p + 8, sizeof(uint32_t));
+        memcpy(&(node->baseEnd[i]), p + 12, sizeof(uint32_t));
+        memcpy(&(node->dataOffset[i]), p + 16, sizeof(uint64_t));
+        if(node->isLeaf) memcpy(&(node->x.size[i]), p + 24, sizeof(uint64_t));
     }
+    free(items);
 
     return node;
 
 error:
+    if(items) free(items);
     if(node->chrIdxStart) free(node->chrIdxStart);
     if(node->baseStart) free(node->baseStart);
     if(node->chrIdxEnd) free(node->chrIdxEnd);
@@ -122,6 +119,21 @@ error:
     return NULL;
 }
 
+//Returns child i of a non-leaf node, reading it in and publishing it if needed. Returns NULL on error.
+static bwRTreeNode_t *getChildNode(bigWigFile_t *fp, bwRTreeNode_t *node, uint16_t i) {
+    bwRTreeNode_t *child = bwLoadPtr(&(node->x.child[i])), *expected = NULL;
+    if(child) return child;
+
+    child = bwGetRTreeNode(fp, node->dataOffset[i]);
+    if(!child) return NULL;
+    if(!bwPublishPtr(&(node->x.child[i]), &expected, child)) {
+        //Another thread got there first
+        bwDestroyIndexNode(child);
+        child = expected;
+    }
+    return child;
+}
+
 void destroyBWOverlapBlock(bwOverlapBlock_t *b) {
     if(!b) return;
     if(b->size) free(b->size);
@@ -226,6 +238,7 @@ error:
 //The output needs to be free()d if not NULL (likewise with *sizes)
 static bwOverlapBlock_t *overlapsNonLeaf(bigWigFile_t *fp, bwRTreeNode_t *node, uint32_t tid, uint32_t start, uint32_t end) {
     uint16_t i;
+    bwRTreeNode_t *child;
     bwOverlapBlock_t *nodeBlocks, *output = calloc(1, sizeof(bwOverlapBlock_t));
     if(!output) return NULL;
 
@@ -243,14 +256,13 @@ static bwOverlapBlock_t *overlapsNonLeaf(bigWigFile_t *fp, bwRTreeNode_t *node,
         }
 
         //We have an overlap!
-        if(!node->x.child[i])
-          node->x.child[i] = bwGetRTreeNode(fp, node->dataOffset[i]);
-        if(!node->x.child[i]) goto error;
+        child = getChildNode(fp, node, i);
+        if(!child) goto error;
 
-        if(node->x.child[i]->isLeaf) { //leaf
-            nodeBlocks = overlapsLeaf(node->x.child[i], tid, start, end);
+        if(child->isLeaf) { //leaf
+            nodeBlocks = overlapsLeaf(child, tid, start, end);
         } else { //non-leaf
-            nodeBlocks = overlapsNonLeaf(fp, node->x.child[i], tid, start, end);
+            nodeBlocks = overlapsNonLeaf(fp, child, tid, start, end);
         }
 
         //The output is processed the same regardless of leaf/non-leaf
@@ -278,6 +290,39 @@ bwOverlapBlock_t *walkRTreeNodes(bigWigFile_t *bw, bwRTreeNode_t *root, uint32_t
     return overlapsNonLeaf(bw, root, tid, start, end);
 }
 
+//Whether item i of a node (a block or a child node) overlaps tid:start-end, by the same rules as overlapsLeaf()/overlapsNonLeaf()
+static int itemOverlaps(const bwRTreeNode_t *node, uint16_t i, uint32_t tid, uint32_t start, uint32_t end) {
+    if(tid < node->chrIdxStart[i] || tid > node->chrIdxEnd[i]) return 0;
+    if(node->chrIdxStart[i] != node->chrIdxEnd[i]) {
+        if(tid == node->chrIdxStart[i]) return node->baseStart[i] < end;
+        if(tid == node->chrIdxEnd[i]) return node->baseEnd[i] > start;
+        return 1;
+    }
+    return node->baseStart[i] < end && node->baseEnd[i] > start;
+}
+
+int costRTreeNodes(bigWigFile_t *fp, bwRTreeNode_t *node, uint32_t tid, uint32_t start, uint32_t end, uint64_t maxBytes, uint64_t *nBlocks, uint64_t *nBytes) {
+    bwRTreeNode_t *child;
+    uint16_t i;
+    int rv;
+
+    for(i=0; i<node->nChildren; i++) {
+        if(tid < node->chrIdxStart[i]) break;
+        if(!itemOverlaps(node, i, tid, start, end)) continue;
+        if(node->isLeaf) {
+            (*nBlocks)++;
+            *nBytes += node->x.size[i];
+            if(*nBytes > maxBytes) return 2;
+        } else {
+            child = getChildNode(fp, node, i);
+            if(!child) return 1;
+            rv = costRTreeNodes(fp, child, tid, start, end, maxBytes, nBlocks, nBytes);
+            if(rv) return rv;
+        }
+    }
+    return 0;
+}
+
 //In reality, a hash or some sort of tree structure is probably faster...
 //Return -1 (AKA 0xFFFFFFFF...) on "not there", so we can hold (2^32)-1 items.
 uint32_t bwGetTid(const bigWigFile_t *fp, const char *chrom) {
@@ -291,6 +336,7 @@ uint32_t bwGetTid(const bigWigFile_t *fp, const char *chrom) {
 
 static bwOverlapBlock_t *bwGetOverlappingBlocks(bigWigFile_t *fp, const char *chrom, uint32_t start, uint32_t end) {
     uint32_t tid = bwGetTid(fp, chrom);
+    bwRTree_t *idx;
 
     if(tid == (uint32_t) -1) {
         BW_STDERR("[bwGetOverlappingBlocks] Non-existent contig: %s\n", chrom);
@@ -298,17 +344,92 @@ static bwOverlapBlock_t *bwGetOverlappingBlocks(bigWigFile_t *fp, const char *ch
     }
 
     //Get the info if needed
-    if(!fp->idx) {
-        fp->idx = readRTreeIdx(fp, fp->hdr->indexOffset);
-        if(!fp->idx) {
-            return NULL;
+    idx = bwLoadIndex(fp, &(fp->idx), 0);
+    if(!idx) return NULL;
+
+    return walkRTreeNodes(fp, idx->root, tid, start, end);
+}
+
+bwOverlappingIntervals_t *bwGetOverlappingIntervalsCore(bigWigFile_t *fp, bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend);
+
+void bwDestroyBlockList(bwBlockList_t *b) {
+    if(!b) return;
+    if(b->start) free(b->start);
+    if(b->end) free(b->end);
+    if(b->offset) free(b->offset);
+    if(b->size) free(b->size);
+    free(b);
+}
+
+static int pushBlock(bwBlockList_t *b, uint32_t start, uint32_t end, uint64_t offset, uint64_t size) {
+    if(b->n + 1 > b->m) {
+        uint64_t m = b->m ? b->m * 2 : 64;
+        uint32_t *s = realloc(b->start, m * sizeof(uint32_t));
+        if(!s) return 1;
+        b->start = s;
+        s = realloc(b->end, m * sizeof(uint32_t));
+        if(!s) return 1;
+        b->end = s;
+        uint64_t *o = realloc(b->offset, m * sizeof(uint64_t));
+        if(!o) return 1;
+        b->offset = o;
+        o = realloc(b->size, m * sizeof(uint64_t));
+        if(!o) return 1;
+        b->size = o;
+        b->m = m;
+    }
+    b->start[b->n] = start;
+    b->end[b->n] = end;
+    b->offset[b->n] = offset;
+    b->size[b->n] = size;
+    b->n++;
+    return 0;
+}
+
+//The same overlap test as overlapsLeaf()/overlapsNonLeaf(), but leaf entries keep their spans
+static int collectBlocks(bigWigFile_t *fp, bwRTreeNode_t *node, uint32_t tid, uint32_t start, uint32_t end, bwBlockList_t *b) {
+    uint16_t i;
+    for(i=0; i<node->nChildren; i++) {
+        if(tid < node->chrIdxStart[i]) break;
+        if(tid > node->chrIdxEnd[i]) continue;
+        uint32_t cs = (node->chrIdxStart[i] < tid) ? 0 : node->baseStart[i];
+        uint32_t ce = (node->chrIdxEnd[i] > tid) ? (uint32_t) -1 : node->baseEnd[i];
+        if(cs >= end || ce <= start) continue;
+
+        if(node->isLeaf) {
+            if(pushBlock(b, cs, ce, node->dataOffset[i], node->x.size[i])) return 1;
+        } else {
+            bwRTreeNode_t *child = getChildNode(fp, node, i);
+            if(!child) return 1;
+            if(collectBlocks(fp, child, tid, start, end, b)) return 1;
         }
     }
+    return 0;
+}
 
-    if(!fp->idx->root) fp->idx->root = bwGetRTreeNode(fp, 0);
-    if(!fp->idx->root) return NULL;
+bwBlockList_t *bwGetBlockList(bigWigFile_t *fp, uint32_t tid, uint32_t start, uint32_t end) {
+    bwBlockList_t *b;
+    bwRTree_t *idx;
+    if(!fp->cl || tid >= fp->cl->nKeys) return NULL;
+    idx = bwLoadIndex(fp, &(fp->idx), 0);
+    if(!idx) return NULL;
+
+    b = calloc(1, sizeof(bwBlockList_t));
+    if(!b) return NULL;
+    if(collectBlocks(fp, idx->root, tid, start, end, b)) {
+        bwDestroyBlockList(b);
+        return NULL;
+    }
+    return b;
+}
 
-    return walkRTreeNodes(fp, fp->idx->root, tid, start, end);
+bwOverlappingIntervals_t *bwReadBlock(bigWigFile_t *fp, const bwBlockList_t *blocks, uint64_t i, uint32_t tid) {
+    bwOverlapBlock_t o;
+    if(i >= blocks->n) return NULL;
+    o.n = 1;
+    o.offset = blocks->offset + i;
+    o.size = blocks->size + i;
+    return bwGetOverlappingIntervalsCore(fp, &o, tid, blocks->start[i], blocks->end[i]);
 }
 
 void bwFillDataHdr(bwDataHeader_t *hdr, void *b) {
@@ -387,16 +508,69 @@ error:
     return NULL;
 }
 
+//Appends the intervals of one uncompressed block (of len bytes) on tid overlapping [ostart, oend) to output
+//Returns NULL on error, in which case output has been free()d
+static bwOverlappingIntervals_t *decodeBlock(bwOverlappingIntervals_t *output, void *buf, uint64_t len, uint32_t tid, uint32_t ostart, uint32_t oend) {
+    uint16_t j;
+    uint32_t start = 0, end, *p;
+    float value;
+    bwDataHeader_t hdr;
+
+    if(len < 24) goto error;
+    bwFillDataHdr(&hdr, buf);
+
+    p = ((uint32_t*) buf);
+    p += 6;
+    if(hdr.tid != tid) return output;
+
+    if(hdr.type == 3) start = hdr.start - hdr.step;
+    if(24 + (uint64_t) hdr.nItems * (hdr.type == 1 ? 12 : (hdr.type == 2 ? 8 : 4)) > len) goto error;
+
+    for(j=0; j<hdr.nItems; j++) {
+        switch(hdr.type) {
+        case 1:
+            start = *p;
+            p++;
+            end = *p;
+            p++;
+            value = *((float *)p);
+            p++;
+            break;
+        case 2:
+            start = *p;
+            p++;
+            end = start + hdr.span;
+            value = *((float *)p);
+            p++;
+            break;
+        case 3:
+            start += hdr.step;
+            end = start+hdr.span;
+            value = *((float *)p);
+            p++;
+            break;
+        default :
+            goto error;
+            break;
+        }
+
+        if(end <= ostart || start >= oend) continue;
+        //Push the overlap
+        if(!pushIntervals(output, start, end, value)) return NULL;
+    }
+    return output;
+
+error:
+    bwDestroyOverlappingIntervals(output);
+    return NULL;
+}
+
 //Returns NULL on error
 bwOverlappingIntervals_t *bwGetOverlappingIntervalsCore(bigWigFile_t *fp, bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend) {
     uint64_t i;
-    uint16_t j;
     int compressed = 0, rv;
     uLongf sz = fp->hdr->bufSize, tmp;
     void *buf = NULL, *compBuf = NULL;
-    uint32_t start = 0, end , *p;
-    float value;
-    bwDataHeader_t hdr;
     bwOverlappingIntervals_t *output = calloc(1, sizeof(bwOverlappingIntervals_t));
 
     if(!output) goto error;
@@ -411,65 +585,24 @@ bwOverlappingIntervals_t *bwGetOverlappingIntervalsCore(bigWigFile_t *fp, bwOver
     sz = 0; //This is now the size of the compressed buffer
 
     for(i=0; i<o->n; i++) {
-        if(bwSetPos(fp, o->offset[i])) goto error;
-
         if(sz < o->size[i]) {
             compBuf = realloc(compBuf, o->size[i]);
             sz = o->size[i];
         }
         if(!compBuf) goto error;
 
-        if(bwRead(compBuf, o->size[i], 1, fp) != 1) goto error;
+        if(bwReadAt(compBuf, o->size[i], o->offset[i], fp)) goto error;
         if(compressed) {
             tmp = fp->hdr->bufSize; //This gets over-written by uncompress
             rv = uncompress(buf, (uLongf *) &tmp, compBuf, o->size[i]);
             if(rv != Z_OK) goto error;
         } else {
             buf = compBuf;
+            tmp = o->size[i];
         }
 
-        //TODO: ensure that tmp is large enough!
-        bwFillDataHdr(&hdr, buf);
-
-        p = ((uint32_t*) buf);
-        p += 6;
-        if(hdr.tid != tid) continue;
-
-        if(hdr.type == 3) start = hdr.start - hdr.step;
-
-        //FIXME: We should ensure that sz is large enough to hold nItems of the given type
-        for(j=0; j<hdr.nItems; j++) {
-            switch(hdr.type) {
-            case 1:
-                start = *p;
-                p++;
-                end = *p;
-                p++;
-                value = *((float *)p);
-                p++;
-                break;
-            case 2:
-                start = *p;
-                p++;
-                end = start + hdr.span;
-                value = *((float *)p);
-                p++;
-                break;
-            case 3:
-                start += hdr.step;
-                end = start+hdr.span;
-                value = *((float *)p);
-                p++;
-                break;
-            default :
-                goto error;
-                break;
-            }
-
-            if(end <= ostart || start >= oend) continue;
-            //Push the overlap
-            if(!pushIntervals(output, start, end, value)) goto error;
-        }
+        output = decodeBlock(output, buf, tmp, tid, ostart, oend);
+        if(!output) goto error;
     }
 
     if(compressed && buf) free(buf);
@@ -484,6 +617,30 @@ error:
     return NULL;
 }
 
+int bwFetchBlocks(bigWigFile_t *fp, const bwBlockList_t *blocks, uint64_t i, uint64_t n, void *buf) {
+    if(!n || i + n > blocks->n) return -1;
+    return bwReadAt(buf, blocks->offset[i+n-1] + blocks->size[i+n-1] - blocks->offset[i], blocks->offset[i], fp);
+}
+
+int bwInflateBlock(const bigWigFile_t *fp, const void *in, uint64_t inSize, void *out, uint64_t *outSize) {
+    uLongf sz;
+    if(!fp->hdr->bufSize) {
+        memcpy(out, in, inSize);
+        *outSize = inSize;
+        return 0;
+    }
+    sz = fp->hdr->bufSize;
+    if(uncompress(out, &sz, in, inSize) != Z_OK) return -1;
+    *outSize = sz;
+    return 0;
+}
+
+bwOverlappingIntervals_t *bwDecodeBlock(void *buf, uint64_t size, uint32_t tid, uint32_t start, uint32_t end) {
+    bwOverlappingIntervals_t *output = calloc(1, sizeof(bwOverlappingIntervals_t));
+    if(!output) return NULL;
+    return decodeBlock(output, buf, size, tid, start, end);
+}
+
 bbOverlappingEntries_t *bbGetOverlappingEntriesCore(bigWigFile_t *fp, bwOverlapBlock_t *o, uint32_t tid, uint32_t ostart, uint32_t oend, int withString) {
     uint64_t i;
     int compressed = 0, rv, slen;
@@ -505,15 +662,13 @@ bbOverlappingEntries_t *bbGetOverlappingEntriesCore(bigWigFile_t *fp, bwOverlapB
     sz = 0; //This is now the size of the compressed buffer
 
     for(i=0; i<o->n; i++) {
-        if(bwSetPos(fp, o->offset[i])) goto error;
-
         if(sz < o->size[i]) {
             compBuf = realloc(compBuf, o->size[i]);
             sz = o->size[i];
         }
         if(!compBuf) goto error;
 
-        if(bwRead(compBuf, o->size[i], 1, fp) != 1) goto error;
+        if(bwReadAt(compBuf, o->size[i], o->offset[i], fp)) goto error;
         if(compressed) {
             tmp = fp->hdr->bufSize; //This gets over-written by uncompress
             rv = uncompress(buf, (uLongf *) &tmp, compBuf, o->size[i]);
@@ -800,3 +955,17 @@ bwRTree_t *bwReadIndex(bigWigFile_t *fp, uint64_t offset) {
     }
     return idx;
 }
+
+bwRTree_t *bwLoadIndex(bigWigFile_t *fp, bwRTree_t **slot, uint64_t offset) {
+    bwRTree_t *idx = bwLoadPtr(slot), *expected = NULL;
+    if(idx) return idx;
+
+    idx = bwReadIndex(fp, offset);
+    if(!idx) return NULL;
+    if(!bwPublishPtr(slot, &expected, idx)) {
+        //Another thread got there first
+        bwDestroyIndex(idx);
+        idx = expected;
+    }
+    return idx;
+}
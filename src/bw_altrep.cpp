@@ -0,0 +1,233 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <R_ext/Altrep.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+
+using namespace Rcpp;
+
+// --- Lazy track -------------------------------------------------------------
+// A bw_import() result kept as the run list it is painted from. Runs are
+// relative to the query start, sorted, non-overlapping and clipped to the
+// query; bases outside every run take `gap` (0 unless asked otherwise; NaN
+// values are stored as gaps). At 12 bytes per interval this is a
+// small fraction of the 8 bytes per base the dense vector would take, and
+// nothing is expanded until R actually asks for values.
+struct BwLazyTrack {
+  R_xlen_t length;
+  double gap; // value of bases outside every run
+  std::vector<uint32_t> start;
+  std::vector<uint32_t> end;
+  std::vector<float> value;
+
+  // Index of the run containing base i, or -1.
+  R_xlen_t find(R_xlen_t i) const {
+    std::vector<uint32_t>::const_iterator it =
+      std::upper_bound(start.begin(), start.end(), static_cast<uint32_t>(i));
+    if (it == start.begin()) return -1;
+    R_xlen_t k = (it - start.begin()) - 1;
+    return static_cast<R_xlen_t>(end[k]) > i ? k : -1;
+  }
+
+  // Fill buf with bases [from, from + n).
+  void fill(R_xlen_t from, R_xlen_t n, double* buf) const {
+    std::fill(buf, buf + n, gap);
+    R_xlen_t k = find(from);
+    if (k < 0) {
+      k = std::upper_bound(start.begin(), start.end(), static_cast<uint32_t>(from)) - start.begin();
+    }
+    const R_xlen_t to = from + n;
+    for (; k < static_cast<R_xlen_t>(start.size()) && static_cast<R_xlen_t>(start[k]) < to; ++k) {
+      R_xlen_t s = std::max<R_xlen_t>(start[k], from);
+      R_xlen_t e = std::min<R_xlen_t>(end[k], to);
+      std::fill(buf + (s - from), buf + (e - from), static_cast<double>(value[k]));
+    }
+  }
+
+  R_xlen_t covered() const {
+    R_xlen_t n = 0;
+    for (size_t k = 0; k < start.size(); ++k) n += end[k] - start[k];
+    return n;
+  }
+};
+
+static R_altrep_class_t bw_lazy_class;
+
+static BwLazyTrack* lazy_track(SEXP x) {
+  return static_cast<BwLazyTrack*>(R_ExternalPtrAddr(R_altrep_data1(x)));
+}
+
+static void lazy_track_finalize(SEXP xp) {
+  delete static_cast<BwLazyTrack*>(R_ExternalPtrAddr(xp));
+  R_ClearExternalPtr(xp);
+}
+
+// Once expanded (e.g. because something asked for a writable pointer) the
+// dense copy in data2 is authoritative.
+static SEXP lazy_expanded(SEXP x) {
+  SEXP d2 = R_altrep_data2(x);
+  return d2 == R_NilValue ? NULL : d2;
+}
+
+static R_xlen_t lazy_Length(SEXP x) {
+  return lazy_track(x)->length;
+}
+
+static Rboolean lazy_Inspect(SEXP x, int, int, int, void (*)(SEXP, int, int, int)) {
+  const BwLazyTrack* t = lazy_track(x);
+  Rprintf("bwimport lazy track (len=%lld, runs=%lld, %s)\n",
+          static_cast<long long>(t->length), static_cast<long long>(t->start.size()),
+          lazy_expanded(x) ? "expanded" : "compact");
+  return TRUE;
+}
+
+static void* lazy_Dataptr(SEXP x, Rboolean) {
+  SEXP d2 = lazy_expanded(x);
+  if (!d2) {
+    const BwLazyTrack* t = lazy_track(x);
+    d2 = PROTECT(Rf_allocVector(REALSXP, t->length));
+    t->fill(0, t->length, REAL(d2));
+    R_set_altrep_data2(x, d2);
+    UNPROTECT(1);
+  }
+  return REAL(d2);
+}
+
+static const void* lazy_Dataptr_or_null(SEXP x) {
+  SEXP d2 = lazy_expanded(x);
+  return d2 ? REAL(d2) : NULL;
+}
+
+static double lazy_Elt(SEXP x, R_xlen_t i) {
+  SEXP d2 = lazy_expanded(x);
+  if (d2) return REAL(d2)[i];
+  const BwLazyTrack* t = lazy_track(x);
+  R_xlen_t k = t->find(i);
+  return k < 0 ? t->gap : static_cast<double>(t->value[k]);
+}
+
+static R_xlen_t lazy_Get_region(SEXP x, R_xlen_t i, R_xlen_t n, double* buf) {
+  const BwLazyTrack* t = lazy_track(x);
+  if (i >= t->length) return 0;
+  n = std::min(n, t->length - i);
+  SEXP d2 = lazy_expanded(x);
+  if (d2) std::copy(REAL(d2) + i, REAL(d2) + i + n, buf);
+  else t->fill(i, n, buf);
+  return n;
+}
+
+// Summaries straight from the runs. Run values are never NA, so only an NA
+// fill in the gaps needs care; anything else defers to R by returning NULL.
+static bool gaps_na(const BwLazyTrack* t) {
+  return ISNAN(t->gap) && t->covered() < t->length;
+}
+
+static SEXP lazy_Sum(SEXP x, Rboolean narm) {
+  if (lazy_expanded(x)) return NULL;
+  const BwLazyTrack* t = lazy_track(x);
+  const bool na_gaps = gaps_na(t);
+  if (na_gaps && !narm) return NULL;
+  double s = na_gaps ? 0.0 : static_cast<double>(t->length - t->covered()) * t->gap;
+  for (size_t k = 0; k < t->start.size(); ++k)
+    s += static_cast<double>(t->end[k] - t->start[k]) * t->value[k];
+  return Rf_ScalarReal(s);
+}
+
+static SEXP lazy_extreme(SEXP x, bool want_max, Rboolean narm) {
+  if (lazy_expanded(x)) return NULL;
+  const BwLazyTrack* t = lazy_track(x);
+  if (t->length == 0) return NULL; // let R produce its usual warning
+  const bool na_gaps = gaps_na(t);
+  if (na_gaps && (!narm || t->value.empty())) return NULL;
+  bool any = !na_gaps && t->covered() < t->length; // gaps contribute fill
+  double o = t->gap;
+  for (size_t k = 0; k < t->value.size(); ++k) {
+    double v = t->value[k];
+    if (!any || (want_max ? v > o : v < o)) o = v;
+    any = true;
+  }
+  return Rf_ScalarReal(o);
+}
+
+static SEXP lazy_Max(SEXP x, Rboolean narm) { return lazy_extreme(x, true, narm); }
+static SEXP lazy_Min(SEXP x, Rboolean narm) { return lazy_extreme(x, false, narm); }
+
+static int lazy_No_NA(SEXP x) {
+  if (lazy_expanded(x)) return 0;
+  return !gaps_na(lazy_track(x));
+}
+
+// [[Rcpp::init]]
+void bw_altrep_init(DllInfo* dll) {
+  bw_lazy_class = R_make_altreal_class("bw_lazy_track", "bwimport", dll);
+  R_set_altrep_Length_method(bw_lazy_class, lazy_Length);
+  R_set_altrep_Inspect_method(bw_lazy_class, lazy_Inspect);
+  R_set_altvec_Dataptr_method(bw_lazy_class, lazy_Dataptr);
+  R_set_altvec_Dataptr_or_null_method(bw_lazy_class, lazy_Dataptr_or_null);
+  R_set_altreal_Elt_method(bw_lazy_class, lazy_Elt);
+  R_set_altreal_Get_region_method(bw_lazy_class, lazy_Get_region);
+  R_set_altreal_Sum_method(bw_lazy_class, lazy_Sum);
+  R_set_altreal_Min_method(bw_lazy_class, lazy_Min);
+  R_set_altreal_Max_method(bw_lazy_class, lazy_Max);
+  R_set_altreal_No_NA_method(bw_lazy_class, lazy_No_NA);
+}
+
+// [[Rcpp::export]]
+SEXP bw_import_lazy_impl(std::string bw_file, std::string chrom, int start, int end,
+                         double fill = 0.0) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+
+  std::string chrom_match;
+  BwHandle bw(open_bw_chrom(bw_file, chrom, chrom_match));
+
+  const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
+
+  // Owned here until the external pointer takes it over.
+  std::unique_ptr<BwLazyTrack> t(new BwLazyTrack());
+  t->length = static_cast<R_xlen_t>(end) - start + 1;
+  t->gap = fill;
+
+  bwOverlappingIntervals_t* iv = bwGetOverlappingIntervals(bw.get(), chrom_match.c_str(), qStart, qEnd);
+  if (!iv)
+    stop("Failed to read intervals for %s:%d-%d in '%s'.",
+         chrom_match.c_str(), start, end, bw_file.c_str());
+  try {
+    t->start.reserve(iv->l);
+    t->end.reserve(iv->l);
+    t->value.reserve(iv->l);
+  } catch (...) {
+    bwDestroyOverlappingIntervals(iv);
+    throw;
+  }
+  // Capacity is reserved, so nothing below allocates.
+  for (uint32_t i = 0; i < iv->l; ++i) {
+    if (iv->end[i] <= qStart || iv->start[i] >= qEnd) continue;
+    uint32_t s = std::max(iv->start[i], qStart) - qStart;
+    uint32_t e = std::min(iv->end[i], qEnd) - qStart;
+    // Later intervals win where they overlap, as when painting densely;
+    // a NaN interval just leaves a gap.
+    while (!t->start.empty() && t->end.back() > s) {
+      if (t->start.back() < s) { t->end.back() = s; break; }
+      t->start.pop_back(); t->end.pop_back(); t->value.pop_back();
+    }
+    if (std::isnan(iv->value[i])) continue;
+    t->start.push_back(s);
+    t->end.push_back(e);
+    t->value.push_back(iv->value[i]);
+  }
+  bwDestroyOverlappingIntervals(iv);
+
+  SEXP xp = PROTECT(R_MakeExternalPtr(t.get(), R_NilValue, R_NilValue));
+  t.release();
+  R_RegisterCFinalizerEx(xp, lazy_track_finalize, TRUE);
+  SEXP out = R_new_altrep(bw_lazy_class, xp, R_NilValue);
+  UNPROTECT(1);
+  return out;
+}
@@ -0,0 +1,402 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bw_async.h"
+#include "bw_cache.h"
+#include "bw_helpers.h"
+#include "bw_pipeline.h"
+
+extern "C" {
+  #include "bwCommon.h"   // bwReadIndex()
+}
+
+using namespace Rcpp;
+
+enum AsyncState { ASYNC_PENDING, ASYNC_RUNNING, ASYNC_DONE, ASYNC_FAILED, ASYNC_CANCELLED };
+static const char* const ASYNC_STATE_NAMES[] = { "pending", "running", "done", "failed", "cancelled" };
+
+// Signalled whenever a job reaches a final state; bw_async_wait_impl()
+// sleeps on it.
+static std::mutex async_mutex;
+static std::condition_variable async_finished;
+
+struct AsyncCancelled {};
+
+// A background job behind a "bw_async" handle: work() runs on a worker
+// thread into plain C++ members, result() turns them into the R value on the
+// main thread once the state is final.
+class AsyncJob : public BwTask {
+public:
+  AsyncJob() : state_(ASYNC_PENDING), cancel_(false), collected_(false) {}
+
+  void run() {
+    int expected = ASYNC_PENDING;
+    if (!state_.compare_exchange_strong(expected, ASYNC_RUNNING)) return; // cancelled
+    int state = ASYNC_DONE;
+    try {
+      work();
+    } catch (const AsyncCancelled&) {
+      state = ASYNC_CANCELLED;
+    } catch (const std::bad_alloc&) {
+      error_ = "Out of memory in the " + describe() + ".";
+      state = ASYNC_FAILED;
+    } catch (const std::exception& e) {
+      error_ = e.what();
+      state = ASYNC_FAILED;
+    }
+    if (state != ASYNC_DONE) release();
+    std::lock_guard<std::mutex> lock(async_mutex);
+    state_ = state;
+    async_finished.notify_all();
+  }
+
+  void cancel() {
+    cancel_ = true;
+    std::lock_guard<std::mutex> lock(async_mutex);
+    int expected = ASYNC_PENDING;
+    if (state_.compare_exchange_strong(expected, ASYNC_CANCELLED)) async_finished.notify_all();
+  }
+
+  int state() const { return state_.load(); }
+  bool finished() const { return state() >= ASYNC_DONE; }
+
+  // The job's value; stops with its error if it failed. Main thread, once
+  // finished(). The buffers are released, so this works once.
+  SEXP collect() {
+    if (state() == ASYNC_FAILED) stop(error_);
+    if (state() == ASYNC_CANCELLED) stop("The %s was cancelled.", describe().c_str());
+    if (collected_) stop("The result of this %s has already been collected.", describe().c_str());
+    collected_ = true;
+    RObject out = result();
+    release();
+    return out;
+  }
+
+protected:
+  virtual void work() = 0;
+  virtual RObject result() = 0;
+  virtual void release() {}
+  virtual std::string describe() const = 0;   // "query for ...", for messages
+
+  void check_cancel() const {
+    if (cancel_) throw AsyncCancelled();
+  }
+
+private:
+  std::atomic<int> state_;
+  std::atomic<bool> cancel_;
+  bool collected_;
+  std::string error_;
+};
+
+// One bw_import_async() query.
+class AsyncQuery : public AsyncJob {
+public:
+  AsyncQuery(const std::string& bw_file, const std::string& chrom, int start, int end,
+             double fill, const std::string& format)
+    : file_(bw_file), chrom_(chrom), start_(start), end_(end), fill_(fill), format_(format) {}
+
+protected:
+  // Streams the region as bw_import() does, checking for cancellation
+  // between blocks.
+  void work() {
+    std::string chrom_match, err;
+    BwHandle bw(try_open_bw_chrom(file_, chrom_, chrom_match, err));
+    if (!bw.get()) throw std::runtime_error(err);
+
+    const uint32_t qStart = static_cast<uint32_t>(start_ - 1); // 0-based inclusive
+    const uint32_t qEnd   = static_cast<uint32_t>(end_);       // 0-based exclusive
+    const bool dense = format_ == "dense", rle_format = format_ == "rle";
+    if (dense) values_.assign(qEnd - qStart, fill_);
+    RleBuilder rle(qEnd - qStart, fill_);
+    const bool ok = bw_stream_intervals(bw.get(), chrom_match, qStart, qEnd,
+                                        [&](const bwOverlappingIntervals_t* iv) {
+      check_cancel();
+      if (dense) {
+        paint_intervals(iv, qStart, qEnd, values_.data(), fill_);
+      } else if (rle_format) {
+        rle.push(iv, qStart, qEnd);
+      } else {
+        for (uint32_t i = 0; i < iv->l; ++i) {
+          if (iv->end[i] <= qStart || iv->start[i] >= qEnd) continue;
+          starts_.push_back(static_cast<int>(std::max(iv->start[i], qStart)) + 1);
+          ends_.push_back(static_cast<int>(std::min(iv->end[i], qEnd)));
+          values_.push_back(std::isnan(iv->value[i]) ? fill_ : static_cast<double>(iv->value[i]));
+        }
+      }
+    });
+    if (!ok) throw std::runtime_error("Failed to read intervals for " + where() + ".");
+    if (rle_format) {
+      rle.finish();
+      values_.swap(rle.values);
+      lengths_.swap(rle.lengths);
+    }
+  }
+
+  // As bw_import() would return it.
+  RObject result() {
+    if (format_ == "dense") return NumericVector(values_.begin(), values_.end());
+    if (format_ == "rle") {
+      List rle = List::create(
+        _["lengths"] = IntegerVector(lengths_.begin(), lengths_.end()),
+        _["values"]  = NumericVector(values_.begin(), values_.end())
+      );
+      rle.attr("class") = "rle";
+      return rle;
+    }
+    List df = List::create(
+      _["start"] = IntegerVector(starts_.begin(), starts_.end()),
+      _["end"]   = IntegerVector(ends_.begin(), ends_.end()),
+      _["value"] = NumericVector(values_.begin(), values_.end())
+    );
+    df.attr("class") = "data.frame";
+    df.attr("row.names") = IntegerVector::create(NA_INTEGER, -static_cast<int>(values_.size()));
+    return df;
+  }
+
+  void release() {
+    std::vector<double>().swap(values_);
+    std::vector<int>().swap(lengths_);
+    std::vector<int>().swap(starts_);
+    std::vector<int>().swap(ends_);
+  }
+
+  std::string describe() const { return "query for " + where(); }
+
+private:
+  std::string where() const {
+    return chrom_ + ":" + std::to_string(start_) + "-" + std::to_string(end_) +
+           " in '" + file_ + "'";
+  }
+
+  std::string file_, chrom_;
+  int start_, end_;
+  double fill_;
+  std::string format_;
+  std::vector<double> values_;               // dense, rle values, interval values
+  std::vector<int> lengths_, starts_, ends_;
+};
+
+// One bw_prefetch(): walks the index for each region on a handle that
+// records into the block cache, then reads the region's data blocks that
+// aren't cached yet, stopping once `budget` bytes (index nodes included)
+// have been read.
+class PrefetchJob : public AsyncJob {
+public:
+  PrefetchJob(const std::string& bw_file, const std::vector<std::string>& chroms,
+              const std::vector<int>& starts, const std::vector<int>& ends, double budget)
+    : file_(bw_file), chroms_(chroms), starts_(starts), ends_(ends), budget_(budget),
+      regions_(0), skipped_(0), blocks_read_(0), blocks_cached_(0), bytes_(0), full_(false) {}
+
+protected:
+  void work() {
+    bigWigFile_t* fp = bwOpen(safe_local_path(file_).c_str(), NULL, "r");
+    if (!fp) throw std::runtime_error("Cannot open BigWig file: " + file_);
+    BwHandle bw(fp);
+    BwCacheRecording recording(fp);
+    // bwOpen() read the index header and root node before fp was recording;
+    // read them again so that later opens are served from memory too.
+    bwRTree_t* idx = bwReadIndex(fp, 0);
+    if (!idx) throw std::runtime_error("Failed to read the index of '" + file_ + "'.");
+    bwDestroyIndex(idx);
+    bytes_ = recording.bytes();
+    full_ = bytes_ > budget_;
+    for (size_t i = 0; i < starts_.size() && !full_; ++i) {
+      check_cancel();
+      const std::string chrom = match_chrom(fp, chroms_[i]);
+      if (chrom.empty() || starts_[i] < 1 || ends_[i] < starts_[i]) {
+        ++skipped_;
+        continue;
+      }
+      bwBlockList_t* blocks = bwGetBlockList(fp, bwGetTid(fp, chrom.c_str()),
+                                             static_cast<uint32_t>(starts_[i] - 1),
+                                             static_cast<uint32_t>(ends_[i]));
+      if (!blocks) throw std::runtime_error("Failed to read the index of '" + file_ + "'.");
+      bytes_ = recording.bytes();
+      if (bytes_ > budget_) {
+        full_ = true;
+        bwDestroyBlockList(blocks);
+        break;
+      }
+      try {
+        read_blocks(fp, blocks, recording);
+      } catch (...) {
+        bwDestroyBlockList(blocks);
+        throw;
+      }
+      bwDestroyBlockList(blocks);
+      if (!full_) ++regions_;
+    }
+  }
+
+  RObject result() {
+    return List::create(
+      _["regions"]       = static_cast<int>(regions_),
+      _["skipped"]       = static_cast<int>(skipped_),
+      _["blocks_read"]   = static_cast<double>(blocks_read_),
+      _["blocks_cached"] = static_cast<double>(blocks_cached_),
+      _["bytes"]         = static_cast<double>(bytes_),
+      _["stopped"]       = full_ ? "budget" : "complete",
+      _["cache_bytes"]   = static_cast<double>(bw_cache().bytes())
+    );
+  }
+
+  std::string describe() const { return "prefetch from '" + file_ + "'"; }
+
+private:
+  // Uncached blocks that lie back to back are read together, up to the
+  // pipeline's read size and what is left of the budget; the recording
+  // handle stores them as they arrive.
+  void read_blocks(bigWigFile_t* fp, const bwBlockList_t* blocks, const BwCacheRecording& recording) {
+    std::vector<unsigned char> buf;
+    for (uint64_t i = 0; i < blocks->n; ) {
+      check_cancel();
+      if (!uncached(fp, blocks, i)) {
+        ++blocks_cached_;
+        ++i;
+        continue;
+      }
+      uint64_t n = 1, bytes = blocks->size[i];
+      if (bytes_ + bytes > budget_) {
+        full_ = true;
+        return;
+      }
+      while (i + n < blocks->n &&
+             blocks->offset[i + n] == blocks->offset[i + n - 1] + blocks->size[i + n - 1] &&
+             bytes + blocks->size[i + n] <= PIPELINE_READ_BYTES &&
+             bytes_ + bytes + blocks->size[i + n] <= budget_ && uncached(fp, blocks, i + n))
+        bytes += blocks->size[i + n++];
+      buf.resize(bytes);
+      if (bwFetchBlocks(fp, blocks, i, n, buf.data()) != 0)
+        throw std::runtime_error("Failed to read data blocks from '" + file_ + "'.");
+      bytes_ = recording.bytes();
+      blocks_read_ += n;
+      i += n;
+    }
+  }
+
+  static bool uncached(const bigWigFile_t* fp, const bwBlockList_t* blocks, uint64_t i) {
+    return !bw_cache().covers(fp, blocks->offset[i], blocks->size[i]);
+  }
+
+  std::string file_;
+  std::vector<std::string> chroms_;
+  std::vector<int> starts_, ends_;
+  double budget_;
+  size_t regions_, skipped_;
+  uint64_t blocks_read_, blocks_cached_, bytes_;
+  bool full_;
+};
+
+// What R holds. Dropping the last reference cancels the job, so one whose
+// handle was garbage collected doesn't keep a worker busy.
+struct AsyncHandle {
+  std::shared_ptr<AsyncJob> job;
+  ~AsyncHandle() { if (job) job->cancel(); }
+};
+
+static SEXP async_submit(const std::shared_ptr<AsyncJob>& job) {
+  XPtr<AsyncHandle> ptr(new AsyncHandle(), true);
+  ptr->job = job;
+  bw_executor().submit(job);
+  return ptr;
+}
+
+static AsyncJob& async_job(SEXP handle) {
+  XPtr<AsyncHandle> h(handle);
+  if (!h.get()) stop("Invalid bw_async handle (it does not survive saving and reloading).");
+  return *h->job;
+}
+
+static std::vector<AsyncJob*> async_jobs(List handles) {
+  std::vector<AsyncJob*> out;
+  for (R_xlen_t i = 0; i < handles.size(); ++i) out.push_back(&async_job(handles[i]));
+  return out;
+}
+
+// Submit a query to the background executor and return its handle at once.
+// [[Rcpp::export]]
+SEXP bw_async_submit_impl(std::string bw_file, std::string chrom, int start, int end,
+                          double fill, std::string format) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+  if (format != "dense" && format != "rle" && format != "intervals")
+    stop("Unknown format '%s'.", format.c_str());
+  ensure_bw_init();
+  return async_submit(std::make_shared<AsyncQuery>(bw_file, chrom, start, end, fill, format));
+}
+
+// Submit a prefetch of the regions (1-based, inclusive) and return its
+// handle at once. `budget` limits this prefetch's reads; `cache_size` is the
+// limit of the cache as a whole.
+// [[Rcpp::export]]
+SEXP bw_prefetch_submit_impl(std::string bw_file, std::vector<std::string> chroms,
+                             std::vector<int> starts, std::vector<int> ends, double budget,
+                             double cache_size) {
+  if (chroms.size() != starts.size() || starts.size() != ends.size())
+    stop("chroms, starts and ends must have the same length.");
+  if (!(budget >= 0)) stop("budget must be a non-negative number of bytes.");
+  if (!(cache_size >= 0)) stop("The bwimport.cache_size option must be a non-negative number of bytes.");
+  ensure_bw_init();
+  bw_cache().set_budget(cache_size < 1e18 ? static_cast<size_t>(cache_size) : static_cast<size_t>(-1));
+  return async_submit(std::make_shared<PrefetchJob>(bw_file, chroms, starts, ends, budget));
+}
+
+// "pending", "running", "done", "failed" or "cancelled" per handle.
+// [[Rcpp::export]]
+CharacterVector bw_async_status_impl(List handles) {
+  std::vector<AsyncJob*> jobs = async_jobs(handles);
+  CharacterVector out(static_cast<int>(jobs.size()));
+  for (size_t i = 0; i < jobs.size(); ++i) out[i] = ASYNC_STATE_NAMES[jobs[i]->state()];
+  return out;
+}
+
+// Wait until every job has finished or `timeout` seconds (Inf: no limit)
+// have passed, staying interruptible. Returns whether all have finished.
+// [[Rcpp::export]]
+bool bw_async_wait_impl(List handles, double timeout) {
+  typedef std::chrono::steady_clock clock;
+  std::vector<AsyncJob*> jobs = async_jobs(handles);
+  const bool forever = !(timeout < R_PosInf);
+  const clock::time_point until = clock::now() + std::chrono::microseconds(
+    static_cast<long long>(forever ? 0 : std::max(0.0, timeout) * 1e6));
+  const auto all_finished = [&jobs] {
+    for (size_t i = 0; i < jobs.size(); ++i)
+      if (!jobs[i]->finished()) return false;
+    return true;
+  };
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(async_mutex);
+      clock::time_point next = clock::now() + std::chrono::milliseconds(100);
+      if (!forever) next = std::min(next, until);
+      if (async_finished.wait_until(lock, next, all_finished)) return true;
+    }
+    if (!forever && clock::now() >= until) return false;
+    checkUserInterrupt();
+  }
+}
+
+// [[Rcpp::export]]
+SEXP bw_async_value_impl(SEXP handle) {
+  AsyncJob& job = async_job(handle);
+  if (!job.finished()) stop("The job has not finished yet.");
+  return job.collect();
+}
+
+// [[Rcpp::export]]
+void bw_async_cancel_impl(List handles) {
+  std::vector<AsyncJob*> jobs = async_jobs(handles);
+  for (size_t i = 0; i < jobs.size(); ++i) jobs[i]->cancel();
+}
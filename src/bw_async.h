@@ -0,0 +1,121 @@
+#ifndef BWIMPORT_ASYNC_H
+#define BWIMPORT_ASYNC_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Background work that outlives the R call submitting it (bw_import_async()
+// queries). Tasks run on a few long-lived worker threads, started on demand,
+// and follow the bw_pool.h rules: plain C++ data only, never the R API.
+// Their results are collected on the main thread.
+
+// One unit of background work.
+class BwTask {
+public:
+  virtual ~BwTask() {}
+  // On a worker thread. Must not throw.
+  virtual void run() = 0;
+  // From any thread: a queued task must not start, a running one should
+  // stop soon. Also called for every task still queued or running when the
+  // executor stops.
+  virtual void cancel() = 0;
+};
+typedef std::shared_ptr<BwTask> BwTaskPtr;
+
+// Workers to allow even on few cores: remote queries spend most of their
+// time waiting on the network.
+static const unsigned int ASYNC_MIN_WORKERS = 4;
+
+class BwExecutor {
+public:
+  BwExecutor() : stopping_(false), idle_(0) {}
+  ~BwExecutor() { stop(); }
+
+  // Queue `task`, starting another worker if there are more queued tasks
+  // than idle workers. With no worker at all (none could be started) the
+  // task runs here and now. Main thread only.
+  void submit(const BwTaskPtr& task) {
+    bool run_here = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(task);
+      if (queue_.size() > idle_ && workers_.size() < max_workers()) {
+        try {
+          workers_.push_back(std::thread(&BwExecutor::work, this));
+        } catch (...) {
+          if (workers_.empty()) {
+            queue_.pop_back();
+            run_here = true;
+          }
+        }
+      }
+    }
+    if (run_here) task->run();
+    else cv_.notify_one();
+  }
+
+  // Cancel everything queued or running and join the workers. The executor
+  // can be used again afterwards. Main thread only.
+  void stop() {
+    std::vector<std::thread> workers;
+    std::deque<BwTaskPtr> queued;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      for (size_t i = 0; i < running_.size(); ++i) running_[i]->cancel();
+      queued.swap(queue_);
+      workers.swap(workers_);
+    }
+    cv_.notify_all();
+    for (size_t i = 0; i < queued.size(); ++i) queued[i]->cancel();
+    for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = false;
+  }
+
+private:
+  static unsigned int max_workers() {
+    return std::max(ASYNC_MIN_WORKERS, std::thread::hardware_concurrency());
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      ++idle_;
+      cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      --idle_;
+      if (stopping_) return;
+      BwTaskPtr task = queue_.front();
+      queue_.pop_front();
+      running_.push_back(task);
+      lock.unlock();
+      task->run();
+      lock.lock();
+      running_.erase(std::find(running_.begin(), running_.end(), task));
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<BwTaskPtr> queue_;
+  std::vector<BwTaskPtr> running_;
+  std::vector<std::thread> workers_;
+  bool stopping_;
+  size_t idle_;
+
+  BwExecutor(const BwExecutor&);
+  BwExecutor& operator=(const BwExecutor&);
+};
+
+// The package's one background executor.
+inline BwExecutor& bw_executor() {
+  static BwExecutor executor;
+  return executor;
+}
+
+#endif // BWIMPORT_ASYNC_H
@@ -0,0 +1,460 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+#include "bw_pool.h"
+
+using namespace Rcpp;
+
+// Regions closer than this share one index query, as long as the combined
+// span stays under MAX_CLUSTER_SPAN.
+static const uint32_t MERGE_GAP = 1 << 16;
+static const uint32_t MAX_CLUSTER_SPAN = 1 << 22;
+// A single-file plan runs as at most this many tasks of consecutive clusters.
+static const size_t MAX_PLAN_TASKS = 256;
+
+// Regions in input order, 0-based half-open. Every region has at least one
+// block (the whole region unless BED12 says otherwise); block coordinates
+// are absolute.
+struct BedRegions {
+  std::vector<std::string> chromNames;  // distinct names
+  std::vector<int> chrom;               // index into chromNames
+  std::vector<uint32_t> start, end;
+  std::vector<uint32_t> blockFirst;     // n + 1 offsets into bStart/bEnd
+  std::vector<uint32_t> bStart, bEnd;
+  std::vector<std::string> name;        // empty unless the input had names
+
+  std::map<std::string, int> chromIndex;
+
+  size_t size() const { return start.size(); }
+
+  void add(const std::string& c, uint32_t s, uint32_t e) {
+    std::map<std::string, int>::iterator it = chromIndex.find(c);
+    if (it == chromIndex.end()) {
+      it = chromIndex.insert(std::make_pair(c, static_cast<int>(chromNames.size()))).first;
+      chromNames.push_back(c);
+    }
+    if (blockFirst.empty()) blockFirst.push_back(0);
+    chrom.push_back(it->second);
+    start.push_back(s);
+    end.push_back(e);
+  }
+  void addBlock(uint32_t s, uint32_t e) { bStart.push_back(s); bEnd.push_back(e); }
+  void closeRegion() { blockFirst.push_back(static_cast<uint32_t>(bStart.size())); }
+};
+
+// Plain decimal number: digits only, no sign or surrounding whitespace,
+// which strtoul() would otherwise let through.
+static bool parse_u32(const char* s, const char* end, uint32_t& out) {
+  if (s == end) return false;
+  uint64_t v = 0;
+  for (; s < end; ++s) {
+    if (*s < '0' || *s > '9') return false;
+    v = v * 10 + static_cast<uint64_t>(*s - '0');
+    if (v > 0xFFFFFFFFu) return false;
+  }
+  out = static_cast<uint32_t>(v);
+  return true;
+}
+
+static bool parse_u32(const char* s, uint32_t& out) {
+  return s && parse_u32(s, s + std::strlen(s), out);
+}
+
+// Comma separated list as written in BED12 columns (a trailing comma is
+// allowed, empty entries are not).
+static bool parse_u32_list(const char* s, std::vector<uint32_t>& out) {
+  out.clear();
+  while (*s) {
+    const char* comma = std::strchr(s, ',');
+    const char* end = comma ? comma : s + std::strlen(s);
+    uint32_t v;
+    if (!parse_u32(s, end, v)) return false;
+    out.push_back(v);
+    s = comma ? comma + 1 : end;
+  }
+  return true;
+}
+
+// Read a BED file (BED3 to BED12, optionally gzip-compressed). Header,
+// track and browser lines are skipped; BED12 lines contribute their exon
+// blocks.
+static void read_bed(const std::string& path, BedRegions& r) {
+  gzFile f = gzopen(path.c_str(), "rb");
+  if (!f)
+    stop("Cannot open BED file: %s", path.c_str());
+
+  std::vector<char> buf(1 << 16);
+  std::string line;
+  std::vector<char*> fields;
+  std::vector<uint32_t> sizes, starts;
+  long lineno = 0;
+  std::string err;
+  bool named = true;
+
+  for (;;) {
+    line.clear();
+    bool got = false;
+    while (gzgets(f, buf.data(), static_cast<int>(buf.size()))) {
+      got = true;
+      line += buf.data();
+      if (!line.empty() && line[line.size() - 1] == '\n') break;
+    }
+    if (!got) break;
+    ++lineno;
+    while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+      line.erase(line.size() - 1);
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    fields.clear();
+    for (char* tok = std::strtok(&line[0], "\t "); tok; tok = std::strtok(NULL, "\t "))
+      fields.push_back(tok);
+    // Track and browser lines, but not chromosomes such as "track_1".
+    if (!fields.empty() && (std::strcmp(fields[0], "track") == 0 ||
+                            std::strcmp(fields[0], "browser") == 0))
+      continue;
+
+    uint32_t s, e;
+    if (fields.size() < 3 || !parse_u32(fields[1], s) || !parse_u32(fields[2], e) || e < s) {
+      err = "Malformed BED line " + std::to_string(lineno) + " in '" + path + "'.";
+      break;
+    }
+    r.add(fields[0], s, e);
+    named = named && fields.size() >= 4;
+    r.name.push_back(fields.size() >= 4 ? fields[3] : "");
+
+    if (fields.size() >= 12) {
+      uint32_t count;
+      if (!parse_u32(fields[9], count) || !parse_u32_list(fields[10], sizes) ||
+          !parse_u32_list(fields[11], starts) || sizes.size() != count || starts.size() != count) {
+        err = "Malformed BED12 blocks on line " + std::to_string(lineno) + " in '" + path + "'.";
+        break;
+      }
+      for (uint32_t b = 0; b < count; ++b) {
+        if (static_cast<uint64_t>(s) + starts[b] + sizes[b] > e) {
+          err = "BED12 block outside its region on line " + std::to_string(lineno) +
+                " in '" + path + "'.";
+          break;
+        }
+        r.addBlock(s + starts[b], s + starts[b] + sizes[b]);
+      }
+      if (!err.empty()) break;
+    } else {
+      r.addBlock(s, e);
+    }
+    r.closeRegion();
+  }
+  gzclose(f);
+  if (!err.empty())
+    stop(err);
+  if (!named) r.name.clear();
+}
+
+struct RegionSummary {
+  double size, covered, sum, min, max;
+};
+
+// Accumulate the intervals of `iv` (sorted, non-overlapping) over
+// [bs, be) into `out`.
+static void summarise_block(const bwOverlappingIntervals_t* iv, uint32_t bs, uint32_t be,
+                            RegionSummary& out) {
+  if (be <= bs) return;
+  uint32_t k = static_cast<uint32_t>(std::upper_bound(iv->end, iv->end + iv->l, bs) - iv->end);
+  for (; k < iv->l && iv->start[k] < be; ++k) {
+    const float v = iv->value[k];
+    if (std::isnan(v)) continue;
+    const uint32_t o = std::min(iv->end[k], be) - std::max(iv->start[k], bs);
+    out.sum += static_cast<double>(v) * o;
+    out.covered += o;
+    if (v < out.min) out.min = v;
+    if (v > out.max) out.max = v;
+  }
+}
+
+// The region set sorted by chromosome name and start and cut into clusters
+// of nearby regions, each read with one index query. It depends only on the
+// regions, so one plan serves any number of files.
+struct RegionPlan {
+  std::vector<size_t> order;
+  struct Cluster { size_t first, last; uint32_t from, to; };  // order[first, last)
+  std::vector<Cluster> clusters;
+
+  explicit RegionPlan(const BedRegions& r) {
+    order.resize(r.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&r](size_t a, size_t b) {
+      if (r.chrom[a] != r.chrom[b]) return r.chrom[a] < r.chrom[b];
+      return r.start[a] < r.start[b];
+    });
+    for (size_t c = 0; c < order.size(); ) {
+      const int chrom = r.chrom[order[c]];
+      Cluster cl = { c, c + 1, r.start[order[c]], r.end[order[c]] };
+      while (cl.last < order.size() && r.chrom[order[cl.last]] == chrom &&
+             static_cast<uint64_t>(r.start[order[cl.last]]) <= static_cast<uint64_t>(cl.to) + MERGE_GAP &&
+             std::max(cl.to, r.end[order[cl.last]]) - cl.from <= MAX_CLUSTER_SPAN) {
+        cl.to = std::max(cl.to, r.end[order[cl.last]]);
+        ++cl.last;
+      }
+      clusters.push_back(cl);
+      c = cl.last;
+    }
+  }
+};
+
+// Clusters [from, to) of a plan; each region is in exactly one cluster, so
+// disjoint cluster ranges fill disjoint entries of `res`.
+static bool run_clusters(bigWigFile_t* bw, const std::string& bw_file, const BedRegions& r,
+                         const RegionPlan& plan, const std::vector<int64_t>& tidOf,
+                         size_t from, size_t to, std::vector<RegionSummary>& res,
+                         std::string& err) {
+  for (size_t k = from; k < to; ++k) {
+    const RegionPlan::Cluster& cl = plan.clusters[k];
+    const int64_t tid = tidOf[r.chrom[plan.order[cl.first]]];
+    if (tid < 0) continue;
+    const uint32_t chromLen = bw->cl->len[tid];
+    const uint32_t cTo = std::min(cl.to, chromLen);
+    if (cTo <= cl.from) continue;
+
+    bwOverlappingIntervals_t* iv = bwGetOverlappingIntervals(bw, bw->cl->chrom[tid], cl.from, cTo);
+    if (!iv) {
+      err = "Failed to read intervals for " + std::string(bw->cl->chrom[tid]) + ":" +
+            std::to_string(cl.from + 1) + "-" + std::to_string(cTo) + " in '" + bw_file + "'.";
+      return false;
+    }
+    for (size_t c = cl.first; c < cl.last; ++c) {
+      const size_t i = plan.order[c];
+      for (uint32_t b = r.blockFirst[i]; b < r.blockFirst[i + 1]; ++b)
+        summarise_block(iv, r.bStart[b], std::min(r.bEnd[b], chromLen), res[i]);
+    }
+    bwDestroyOverlappingIntervals(iv);
+  }
+  return true;
+}
+
+// Execute a plan against one open file, filling `res` (input order), with
+// the clusters spread over up to `n_threads` threads sharing `bw`.
+// Chromosome names are matched per file. Touches no R API, so it can run
+// on a worker thread; returns false with `err` set if a read fails.
+static bool run_plan(bigWigFile_t* bw, const std::string& bw_file, const BedRegions& r,
+                     const RegionPlan& plan, std::vector<RegionSummary>& res,
+                     size_t& n_unknown, std::string& err, unsigned int n_threads) {
+  const double inf = std::numeric_limits<double>::infinity();
+  std::vector<int64_t> tidOf(r.chromNames.size());
+  for (size_t c = 0; c < r.chromNames.size(); ++c) {
+    std::string m = match_chrom(bw, r.chromNames[c]);
+    tidOf[c] = m.empty() ? -1 : static_cast<int64_t>(bwGetTid(bw, m.c_str()));
+  }
+
+  res.resize(r.size());
+  n_unknown = 0;
+  for (size_t i = 0; i < r.size(); ++i) {
+    RegionSummary& s = res[i];
+    s.size = 0;
+    for (uint32_t b = r.blockFirst[i]; b < r.blockFirst[i + 1]; ++b) s.size += r.bEnd[b] - r.bStart[b];
+    s.covered = 0; s.sum = 0; s.min = inf; s.max = -inf;
+    if (tidOf[r.chrom[i]] < 0) ++n_unknown;
+  }
+
+  const size_t n_clusters = plan.clusters.size();
+  if (n_threads < 2 || n_clusters < 2)
+    return run_clusters(bw, bw_file, r, plan, tidOf, 0, n_clusters, res, err);
+
+  // Tasks of consecutive clusters, handed out one at a time.
+  const size_t n_tasks = std::min(n_clusters, MAX_PLAN_TASKS);
+  std::vector<std::string> errors(n_tasks);
+  bw_parallel_for(n_tasks, std::min<unsigned int>(n_threads, static_cast<unsigned int>(n_tasks)),
+                  [&](size_t t) {
+                    run_clusters(bw, bw_file, r, plan, tidOf, n_clusters * t / n_tasks,
+                                 n_clusters * (t + 1) / n_tasks, res, errors[t]);
+                  },
+                  [&](size_t t) { errors[t] = "Out of memory while reading '" + bw_file + "'."; });
+  for (size_t t = 0; t < n_tasks; ++t) {
+    if (!errors[t].empty()) {
+      err = errors[t];
+      return false;
+    }
+  }
+  return true;
+}
+
+enum SummaryStat { SUM_SIZE, SUM_COVERED, SUM_SUM, SUM_MEAN0, SUM_MEAN, SUM_MIN, SUM_MAX, SUM_N };
+static const char* summary_names[SUM_N] = { "size", "covered", "sum", "mean0", "mean", "min", "max" };
+
+static SummaryStat summary_stat(const std::string& stat) {
+  for (int k = 0; k < SUM_N; ++k)
+    if (stat == summary_names[k]) return static_cast<SummaryStat>(k);
+  stop("Unknown statistic '%s'.", stat.c_str());
+  return SUM_N;
+}
+
+static double summary_value(const RegionSummary& s, SummaryStat stat) {
+  const bool any = s.covered > 0;
+  switch (stat) {
+  case SUM_SIZE:    return s.size;
+  case SUM_COVERED: return s.covered;
+  case SUM_SUM:     return s.sum;
+  case SUM_MEAN0:   return s.size > 0 ? s.sum / s.size : NA_REAL;
+  case SUM_MEAN:    return any ? s.sum / s.covered : NA_REAL;
+  case SUM_MIN:     return any ? s.min : NA_REAL;
+  case SUM_MAX:     return any ? s.max : NA_REAL;
+  default:          return NA_REAL;
+  }
+}
+
+static BedRegions regions_from_vectors(const std::vector<std::string>& chroms,
+                                       const IntegerVector& starts, const IntegerVector& ends) {
+  const R_xlen_t n = starts.size();
+  if (static_cast<R_xlen_t>(chroms.size()) != n || ends.size() != n)
+    stop("chrom, start and end must have the same length.");
+  BedRegions r;
+  for (R_xlen_t i = 0; i < n; ++i) {
+    if (starts[i] == NA_INTEGER || ends[i] == NA_INTEGER || starts[i] < 1 || ends[i] < starts[i])
+      stop("Invalid coordinates in region %d: start must be >= 1 and end >= start.",
+           static_cast<int>(i + 1));
+    r.add(chroms[i], static_cast<uint32_t>(starts[i] - 1), static_cast<uint32_t>(ends[i]));
+    r.addBlock(static_cast<uint32_t>(starts[i] - 1), static_cast<uint32_t>(ends[i]));
+    r.closeRegion();
+  }
+  return r;
+}
+
+// Per-region summaries in the manner of UCSC bigWigAverageOverBed: size
+// (bases in the region, or in its exon blocks for BED12), covered, sum,
+// mean0 (sum / size), mean (sum / covered), min and max, in input order.
+static List summarise_regions(const std::string& bw_file, const BedRegions& r, int threads) {
+  ensure_bw_init();
+  BwHandle bw(bwOpen(safe_local_path(bw_file).c_str(), NULL, "r"));
+  if (!bw.get())
+    stop("Cannot open BigWig file: %s", bw_file.c_str());
+
+  const RegionPlan plan(r);
+  std::vector<RegionSummary> res;
+  size_t n_unknown;
+  std::string err;
+  if (!run_plan(bw.get(), bw_file, r, plan, res, n_unknown, err,
+                bw_thread_count(threads, plan.clusters.size())))
+    stop(err);
+
+  if (n_unknown > 0)
+    warning("%d region(s) on chromosomes not in '%s' have no coverage.",
+            static_cast<int>(n_unknown), bw_file.c_str());
+
+  const size_t n = r.size();
+  List out;
+  if (!r.name.empty()) out.push_back(wrap(r.name), "name");
+  for (int k = 0; k < SUM_N; ++k) {
+    NumericVector col(no_init(n));
+    for (size_t i = 0; i < n; ++i) col[i] = summary_value(res[i], static_cast<SummaryStat>(k));
+    out.push_back(col, summary_names[k]);
+  }
+  return out;
+}
+
+// [[Rcpp::export]]
+List bw_bed_summary_file_impl(std::string bw_file, std::string bed_file, int threads) {
+  BedRegions r;
+  read_bed(bed_file, r);
+  return summarise_regions(bw_file, r, threads);
+}
+
+// Regions given as vectors: 1-based inclusive, like bw_import().
+// [[Rcpp::export]]
+List bw_bed_summary_impl(std::string bw_file, std::vector<std::string> chroms,
+                         IntegerVector starts, IntegerVector ends, int threads) {
+  return summarise_regions(bw_file, regions_from_vectors(chroms, starts, ends), threads);
+}
+
+// --- Regions x files ---------------------------------------------------------
+
+struct SummaryJob {
+  const std::vector<std::string>* files;
+  const BedRegions* regions;
+  const RegionPlan* plan;
+  SummaryStat stat;
+  double* data;                       // column-major, one column per file
+  std::vector<std::string>* errors;
+  std::vector<double>* ms;
+  std::vector<size_t>* unknown;
+};
+
+static void summary_column(SummaryJob& job, size_t j) {
+  typedef std::chrono::steady_clock clock;
+  const clock::time_point t0 = clock::now();
+  const std::string& file = (*job.files)[j];
+  const size_t n = job.regions->size();
+  double* col = job.data + j * n;
+
+  std::vector<RegionSummary> res;
+  bigWigFile_t* bw = bwOpen(safe_local_path(file).c_str(), NULL, "r");
+  bool ok = bw != NULL;
+  if (!ok) (*job.errors)[j] = "Cannot open BigWig file: " + file;
+  else ok = run_plan(bw, file, *job.regions, *job.plan, res, (*job.unknown)[j], (*job.errors)[j], 1);
+  if (bw) bwClose(bw);
+
+  for (size_t i = 0; i < n; ++i) col[i] = ok ? summary_value(res[i], job.stat) : NA_REAL;
+  (*job.ms)[j] = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+}
+
+// N regions x M files matrix of one summary statistic. The region set is
+// planned once; every file runs the plan on its own handle on a worker
+// thread and fills its column. A failing file gets an NA column, its
+// message in attr(, "errors"); attr(, "ms") has the per-file wall time.
+// [[Rcpp::export]]
+NumericMatrix bw_summary_matrix_impl(std::vector<std::string> bw_files,
+                                     std::vector<std::string> chroms,
+                                     IntegerVector starts, IntegerVector ends,
+                                     std::string bed_file, std::string stat, int threads) {
+  const SummaryStat st = summary_stat(stat);
+
+  BedRegions r;
+  if (!bed_file.empty()) read_bed(bed_file, r);
+  else r = regions_from_vectors(chroms, starts, ends);
+  const RegionPlan plan(r);
+
+  ensure_bw_init(); // on the main thread, before any worker opens a file
+
+  const int nrow = static_cast<int>(r.size());
+  const int ncol = static_cast<int>(bw_files.size());
+  NumericMatrix out(no_init(nrow, ncol));
+  std::vector<std::string> errors(ncol);
+  std::vector<double> ms(ncol, NA_REAL);
+  std::vector<size_t> unknown(ncol, 0);
+
+  SummaryJob job;
+  job.files = &bw_files;
+  job.regions = &r;
+  job.plan = &plan;
+  job.stat = st;
+  job.data = out.begin();
+  job.errors = &errors;
+  job.ms = &ms;
+  job.unknown = &unknown;
+
+  bw_parallel_for(bw_files.size(), bw_thread_count(threads, bw_files.size()),
+                  [&](size_t j) { summary_column(job, j); },
+                  [&](size_t j) {
+                    errors[j] = "Internal error while reading '" + bw_files[j] + "'.";
+                    std::fill(job.data + j * nrow, job.data + (j + 1) * nrow, NA_REAL);
+                  });
+
+  CharacterVector err(ncol);
+  for (int j = 0; j < ncol; ++j) {
+    if (errors[j].empty()) err[j] = NA_STRING;
+    else                   err[j] = errors[j];
+  }
+  out.attr("errors") = err;
+  out.attr("ms") = NumericVector(ms.begin(), ms.end());
+  out.attr("unknown") = NumericVector(unknown.begin(), unknown.end());
+  if (!r.name.empty()) out.attr("region_names") = wrap(r.name);
+  return out;
+}
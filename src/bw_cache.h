@@ -0,0 +1,267 @@
+#ifndef BWIMPORT_CACHE_H
+#define BWIMPORT_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+  #include "bigWig.h"
+  #include "bigWigIO.h"
+}
+
+// Which version of its file an open handle reads: what urlOpen() saw of the
+// file (size and modification time, or the server's ETag, Last-Modified and
+// size), and the header fields that move whenever the data does, in case a
+// rewrite keeps the same size within the same second.
+inline std::string bw_cache_version(const bigWigFile_t* fp) {
+  std::string version(fp->URL->version);
+  if (fp->hdr) {
+    char hdr[160];
+    std::snprintf(hdr, sizeof(hdr), "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %a %a %a %a",
+                  fp->hdr->ctOffset, fp->hdr->dataOffset, fp->hdr->indexOffset,
+                  fp->hdr->nBasesCovered, fp->hdr->minVal, fp->hdr->maxVal,
+                  fp->hdr->sumData, fp->hdr->sumSquared);
+    version += hdr;
+  }
+  return version;
+}
+
+// In-memory copy of file ranges that bw_prefetch() has read: index nodes and
+// data blocks, keyed by the path or URL the file was opened with. It sits in
+// front of every read libBigWig makes on an open file (bwSetReadCache()), so
+// any later query whose reads fall inside cached ranges is answered from
+// memory, whichever entry point it came through and whichever handle it
+// uses. Only reads made by handles registered with record() are stored;
+// ordinary queries just look up. Ranges are kept disjoint and evicted least
+// recently used first once the budget is exceeded. Each file's ranges are
+// tagged with the version they were read from (bw_cache_version()); a handle
+// on any other version finds the file changed and drops them.
+class BwBlockCache {
+public:
+  BwBlockCache() : bytes_(0), budget_(256u << 20), n_ranges_(0), n_recording_(0) {}
+
+  // Copy [pos, pos + sz) of fp's file into buf if all of it is cached,
+  // possibly across several adjacent ranges.
+  bool lookup(const bigWigFile_t* fp, void* buf, size_t sz, size_t pos) {
+    if (n_ranges_.load() == 0) return false;
+    const std::string version = bw_cache_version(fp);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Files::iterator f = current(fp->URL->fname, version);
+    if (f == files_.end()) return false;
+    unsigned char* out = static_cast<unsigned char*>(buf);
+    for (size_t at = pos; at < pos + sz; ) {
+      Ranges::iterator r = containing(f->second.ranges, at);
+      if (r == f->second.ranges.end()) return false;
+      const size_t n = std::min(pos + sz, r->first + r->second.bytes.size()) - at;
+      std::memcpy(out + (at - pos), r->second.bytes.data() + (at - r->first), n);
+      lru_.splice(lru_.begin(), lru_, r->second.lru);
+      at += n;
+    }
+    return true;
+  }
+
+  // Whether all of [pos, pos + sz) of fp's file is cached.
+  bool covers(const bigWigFile_t* fp, size_t pos, size_t sz) {
+    const std::string version = bw_cache_version(fp);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Files::iterator f = current(fp->URL->fname, version);
+    if (f == files_.end()) return false;
+    for (size_t at = pos; at < pos + sz; ) {
+      Ranges::iterator r = containing(f->second.ranges, at);
+      if (r == f->second.ranges.end()) return false;
+      at = r->first + r->second.bytes.size();
+    }
+    return true;
+  }
+
+  // Keep the parts of [pos, pos + sz) not cached yet, if `fp` is recording.
+  void store(const bigWigFile_t* fp, const void* buf, size_t sz, size_t pos) {
+    if (n_recording_.load() == 0) return;
+    const std::string version = bw_cache_version(fp);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Recording::iterator rec = recording_.find(fp);
+    if (rec == recording_.end()) return;
+    rec->second += sz;
+    const std::string file(fp->URL->fname);
+    Files::iterator f = current(file, version);
+    if (f == files_.end()) {
+      f = files_.insert(std::make_pair(file, FileRanges())).first;
+      f->second.version = version;
+    }
+    Ranges& ranges = f->second.ranges;
+    const unsigned char* in = static_cast<const unsigned char*>(buf);
+    for (size_t at = pos; at < pos + sz; ) {
+      Ranges::iterator r = containing(ranges, at);
+      if (r != ranges.end()) {                       // already cached: skip it
+        at = r->first + r->second.bytes.size();
+        continue;
+      }
+      Ranges::iterator next = ranges.upper_bound(at);
+      const size_t to = next == ranges.end() ? pos + sz : std::min(pos + sz, next->first);
+      std::vector<unsigned char> bytes(in + (at - pos), in + (to - pos));
+      lru_.push_front(std::make_pair(file, at));
+      try {
+        Range& range = ranges[at];
+        range.bytes.swap(bytes);
+        range.lru = lru_.begin();
+      } catch (...) {
+        lru_.pop_front();
+        throw;
+      }
+      bytes_ += to - at;
+      ++n_ranges_;
+      at = to;
+    }
+    evict();
+  }
+
+  // Start or stop storing what `fp` reads.
+  void record(const bigWigFile_t* fp, bool on) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (on) {
+      recording_[fp] = 0;
+      ++n_recording_;
+    } else {
+      recording_.erase(fp);
+      --n_recording_;
+    }
+  }
+
+  // Bytes `fp` has read from its file since it started recording: index
+  // nodes as well as blocks, but not what the cache already held.
+  uint64_t recorded(const bigWigFile_t* fp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Recording::const_iterator rec = recording_.find(fp);
+    return rec == recording_.end() ? 0 : rec->second;
+  }
+
+  void set_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    evict();
+  }
+
+  size_t bytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_.clear();
+    lru_.clear();
+    bytes_ = 0;
+    n_ranges_ = 0;
+  }
+
+private:
+  typedef std::list<std::pair<std::string, size_t> > Lru;   // most recent first
+  struct Range {
+    std::vector<unsigned char> bytes;
+    Lru::iterator lru;
+  };
+  typedef std::map<size_t, Range> Ranges;                   // by file offset
+  struct FileRanges {
+    std::string version;
+    Ranges ranges;
+  };
+  typedef std::map<std::string, FileRanges> Files;
+  typedef std::map<const bigWigFile_t*, uint64_t> Recording; // bytes each has read
+
+  // The ranges of `file` if they were read from `version`, or end(). Ranges
+  // of any other version are stale and dropped.
+  Files::iterator current(const std::string& file, const std::string& version) {
+    Files::iterator f = files_.find(file);
+    if (f == files_.end() || f->second.version == version) return f;
+    for (Ranges::iterator r = f->second.ranges.begin(); r != f->second.ranges.end(); ++r) {
+      bytes_ -= r->second.bytes.size();
+      --n_ranges_;
+      lru_.erase(r->second.lru);
+    }
+    files_.erase(f);
+    return files_.end();
+  }
+
+  // The range holding byte `at`, or end().
+  static Ranges::iterator containing(Ranges& ranges, size_t at) {
+    Ranges::iterator r = ranges.upper_bound(at);
+    if (r == ranges.begin()) return ranges.end();
+    --r;
+    return r->first + r->second.bytes.size() > at ? r : ranges.end();
+  }
+
+  void evict() {
+    while (bytes_ > budget_ && !lru_.empty()) {
+      Files::iterator f = files_.find(lru_.back().first);
+      Ranges::iterator r = f->second.ranges.find(lru_.back().second);
+      bytes_ -= r->second.bytes.size();
+      --n_ranges_;
+      f->second.ranges.erase(r);
+      if (f->second.ranges.empty()) files_.erase(f);
+      lru_.pop_back();
+    }
+  }
+
+  std::mutex mutex_;
+  Files files_;
+  Lru lru_;
+  size_t bytes_, budget_;
+  std::atomic<size_t> n_ranges_;                  // lets lookup() skip the lock
+  std::atomic<int> n_recording_;                  // lets store() skip it
+  Recording recording_;
+
+  BwBlockCache(const BwBlockCache&);
+  BwBlockCache& operator=(const BwBlockCache&);
+};
+
+// The package's one cache.
+inline BwBlockCache& bw_cache() {
+  static BwBlockCache cache;
+  return cache;
+}
+
+// libBigWig's side of it. The callbacks run on whichever thread reads and
+// must not throw into C; a failed lookup or store just means a file read.
+static int bw_cache_lookup_cb(const bigWigFile_t* fp, void* buf, size_t sz, size_t pos) {
+  try {
+    return bw_cache().lookup(fp, buf, sz, pos) ? 0 : -1;
+  } catch (...) {
+    return -1;
+  }
+}
+
+static void bw_cache_store_cb(const bigWigFile_t* fp, const void* buf, size_t sz, size_t pos) {
+  try {
+    bw_cache().store(fp, buf, sz, pos);
+  } catch (...) {
+  }
+}
+
+inline const bwReadCache_t* bw_cache_hooks() {
+  static const bwReadCache_t hooks = { bw_cache_lookup_cb, bw_cache_store_cb };
+  return &hooks;
+}
+
+// Records what `fp` reads while in scope.
+class BwCacheRecording {
+public:
+  explicit BwCacheRecording(const bigWigFile_t* fp) : fp_(fp) { bw_cache().record(fp_, true); }
+  ~BwCacheRecording() { bw_cache().record(fp_, false); }
+  uint64_t bytes() const { return bw_cache().recorded(fp_); }
+private:
+  const bigWigFile_t* fp_;
+  BwCacheRecording(const BwCacheRecording&);
+  BwCacheRecording& operator=(const BwCacheRecording&);
+};
+
+#endif // BWIMPORT_CACHE_H
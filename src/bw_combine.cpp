@@ -0,0 +1,239 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+
+using namespace Rcpp;
+
+// Streams one track over [qStart, qEnd) as consecutive segments that cover
+// the whole query: the file's intervals, and `fill` over the gaps between
+// them. Only the current decoded block is held in memory.
+class TrackCursor {
+public:
+  TrackCursor(const std::string& bw_file, const std::string& chrom,
+              uint32_t qStart, uint32_t qEnd, double fill)
+    : file_(bw_file), bw_(NULL), blocks_(NULL), iv_(NULL), tid_(0), b_(0), i_(0),
+      qEnd_(qEnd), pos_(qStart), fill_(fill), end(qStart), value(fill) {
+    std::string chrom_match;
+    bw_ = open_bw_chrom(bw_file, chrom, chrom_match);
+    tid_ = bwGetTid(bw_, chrom_match.c_str());
+    blocks_ = bwGetBlockList(bw_, tid_, qStart, qEnd);
+    try {
+      if (!blocks_)
+        stop("Failed to read intervals from '%s'.", file_.c_str());
+      next();
+    } catch (...) {      // the destructor won't run for a half-built cursor
+      release();
+      throw;
+    }
+  }
+
+  ~TrackCursor() { release(); }
+
+  // Move on to the segment starting at `end`.
+  void next() {
+    for (;;) {
+      if (iv_) {
+        for (; i_ < iv_->l; ++i_) {
+          const uint32_t s = std::max(iv_->start[i_], pos_);
+          const uint32_t e = std::min(iv_->end[i_], qEnd_);
+          if (e <= s) continue;              // before the query, or overlapped
+          if (s > pos_) {                    // a gap first
+            set(s, fill_);
+          } else {
+            set(e, std::isnan(iv_->value[i_]) ? fill_ : static_cast<double>(iv_->value[i_]));
+            ++i_;
+          }
+          return;
+        }
+        bwDestroyOverlappingIntervals(iv_);
+        iv_ = NULL;
+      }
+      if (b_ == blocks_->n) break;
+      iv_ = bwReadBlock(bw_, blocks_, b_++, tid_);
+      i_ = 0;
+      if (!iv_)
+        stop("Failed to read intervals from '%s'.", file_.c_str());
+    }
+    set(qEnd_, fill_);
+  }
+
+private:
+  void set(uint32_t e, double v) {
+    end = pos_ = e;
+    value = v;
+  }
+
+  void release() {
+    if (iv_) bwDestroyOverlappingIntervals(iv_);
+    if (blocks_) bwDestroyBlockList(blocks_);
+    if (bw_) bwClose(bw_);
+    iv_ = NULL;
+    blocks_ = NULL;
+    bw_ = NULL;
+  }
+
+  std::string file_;
+  bigWigFile_t* bw_;
+  bwBlockList_t* blocks_;
+  bwOverlappingIntervals_t* iv_;   // the current block's intervals
+  uint32_t tid_;
+  uint64_t b_;                     // the next block to read
+  uint32_t i_, qEnd_, pos_;
+  double fill_;
+
+  TrackCursor(const TrackCursor&);
+  TrackCursor& operator=(const TrackCursor&);
+
+public:
+  uint32_t end;   // the current segment ends here (0-based, exclusive)
+  double value;
+};
+
+enum CombineOp { COMBINE_SUM, COMBINE_MEAN, COMBINE_RATIO, COMBINE_LOG2FC };
+
+// Combined value of one segment. `x` holds the tracks, the `n_case` first
+// being the case group and the rest the control group. Any NA input makes
+// the result NA.
+static double combine(const std::vector<double>& x, size_t n_case, CombineOp op, double pc) {
+  double a = 0, b = 0;
+  for (size_t j = 0; j < x.size(); ++j) {
+    if (std::isnan(x[j])) return NA_REAL;
+    if (j < n_case) a += x[j];
+    else            b += x[j];
+  }
+  if (op == COMBINE_SUM) return a;
+  a /= n_case;
+  if (op == COMBINE_MEAN) return a;
+  b /= x.size() - n_case;
+  const double r = (a + pc) / (b + pc);
+  if (op == COMBINE_RATIO) return r;
+  return r > 0 ? std::log2(r) : (r == 0 ? R_NegInf : R_NaN);
+}
+
+// Mean of the combined track in `nbins` bins, split like bw_stats(): bin i
+// ends at start + floor(width * (i + 1) / nbins). NA bases are left out;
+// a bin with nothing else is NA.
+class BinSink {
+public:
+  BinSink(uint32_t qStart, uint32_t qEnd, int nbins)
+    : qStart_(qStart), width_(qEnd - qStart), nbins_(nbins), bin_(0),
+      sum_(nbins, 0.0), n_(nbins, 0.0) {}
+
+  void push(uint32_t s, uint32_t e, double v) {
+    while (s < e) {
+      while (s >= bin_end(bin_)) ++bin_;
+      const uint32_t be = std::min(e, bin_end(bin_));
+      if (!std::isnan(v)) {
+        sum_[bin_] += v * (be - s);
+        n_[bin_] += be - s;
+      }
+      s = be;
+    }
+  }
+
+  NumericVector values() const {
+    NumericVector out(no_init(nbins_));
+    for (int i = 0; i < nbins_; ++i) out[i] = n_[i] > 0 ? sum_[i] / n_[i] : NA_REAL;
+    return out;
+  }
+
+private:
+  uint32_t bin_end(int i) const {
+    return qStart_ + static_cast<uint32_t>(static_cast<uint64_t>(width_) * (i + 1) / nbins_);
+  }
+
+  uint32_t qStart_, width_;
+  int nbins_, bin_;
+  std::vector<double> sum_, n_;
+};
+
+typedef std::vector<std::unique_ptr<TrackCursor> > TrackSet;
+
+// The merge sweep: hands sink(s, e, value) each stretch [s, e) over which
+// no track changes, in order, so every stretch is combined once.
+template <typename Sink>
+static void combine_sweep(TrackSet& tracks, uint32_t qStart, uint32_t qEnd, size_t n_case,
+                          CombineOp op, double pc, Sink sink) {
+  std::vector<double> x(tracks.size());
+  uint64_t stretches = 0;
+  for (uint32_t pos = qStart; pos < qEnd; ) {
+    uint32_t to = qEnd;
+    for (size_t j = 0; j < tracks.size(); ++j) {
+      x[j] = tracks[j]->value;
+      to = std::min(to, tracks[j]->end);
+    }
+    sink(pos, to, combine(x, n_case, op, pc));
+    pos = to;
+    for (size_t j = 0; j < tracks.size(); ++j)
+      if (tracks[j]->end == pos && pos < qEnd) tracks[j]->next();
+    if (++stretches % 65536 == 0) checkUserInterrupt();
+  }
+}
+
+// Track arithmetic over [start, end] on `chrom`: the sum or mean of
+// `bw_files`, or the ratio / log2 fold change of their mean (plus
+// `pseudocount`) over the mean of `control_files`. All tracks are streamed
+// block by block and merge-swept together, so no per-track vector is ever
+// built. `format` picks dense, "rle" or "bins" (means over `nbins` bins)
+// output.
+// [[Rcpp::export]]
+SEXP bw_combine_impl(std::vector<std::string> bw_files, std::vector<std::string> control_files,
+                     std::string chrom, int start, int end, std::string op,
+                     double pseudocount, double fill, std::string format, int nbins) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+  CombineOp cop;
+  if      (op == "sum")    cop = COMBINE_SUM;
+  else if (op == "mean")   cop = COMBINE_MEAN;
+  else if (op == "ratio")  cop = COMBINE_RATIO;
+  else if (op == "log2fc") cop = COMBINE_LOG2FC;
+  else stop("Unknown operation '%s'.", op.c_str());
+  const bool two_groups = cop == COMBINE_RATIO || cop == COMBINE_LOG2FC;
+  if (bw_files.empty() || (two_groups && control_files.empty()))
+    stop("'%s' needs at least one file in each group.", op.c_str());
+  if (format == "bins" && (nbins < 1 || nbins > end - start + 1))
+    stop("nbins must be between 1 and the width of the region.");
+
+  const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
+
+  std::vector<std::string> files(bw_files);
+  if (two_groups) files.insert(files.end(), control_files.begin(), control_files.end());
+  const size_t n_case = bw_files.size();
+
+  ensure_bw_init();
+  TrackSet tracks;
+  for (size_t j = 0; j < files.size(); ++j)
+    tracks.push_back(std::unique_ptr<TrackCursor>(new TrackCursor(files[j], chrom, qStart, qEnd, fill)));
+
+  if (format == "dense") {
+    NumericVector out(no_init(end - start + 1));
+    combine_sweep(tracks, qStart, qEnd, n_case, cop, pseudocount,
+                  [&](uint32_t s, uint32_t e, double v) {
+                    std::fill(out.begin() + (s - qStart), out.begin() + (e - qStart), v);
+                  });
+    return out;
+  }
+  if (format == "bins") {
+    BinSink bins(qStart, qEnd, nbins);
+    combine_sweep(tracks, qStart, qEnd, n_case, cop, pseudocount,
+                  [&](uint32_t s, uint32_t e, double v) { bins.push(s, e, v); });
+    return bins.values();
+  }
+  RleBuilder rle(qEnd - qStart, NA_REAL);
+  combine_sweep(tracks, qStart, qEnd, n_case, cop, pseudocount,
+                [&](uint32_t s, uint32_t e, double v) { rle.push(s - qStart, e - qStart, v); });
+  rle.finish();
+  List out = List::create(
+    _["lengths"] = IntegerVector(rle.lengths.begin(), rle.lengths.end()),
+    _["values"]  = NumericVector(rle.values.begin(), rle.values.end())
+  );
+  out.attr("class") = "rle";
+  return out;
+}
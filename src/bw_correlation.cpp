@@ -0,0 +1,257 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+#include "bw_pool.h"
+#include "bw_tiles.h"
+
+using namespace Rcpp;
+
+// Bins summarised per file before they are folded into the running sums;
+// bounds memory at files x CORR_CHUNK_BINS values whatever the genome size.
+static const uint32_t CORR_CHUNK_BINS = 1 << 16;
+
+// Worker threads only see plain C++ data; see bw_pool.h. The same job first
+// opens every file, then summarises one chunk at a time.
+struct CorrJob {
+  const std::vector<std::string>* files;
+  std::vector<bigWigFile_t*> handles;
+  std::vector<std::string> errors;
+
+  // The current chunk: [from, to) of `chrom`, in bins of `width`.
+  std::string chrom;
+  uint32_t from, to, width;
+  TileStat stat;
+  double tolerance, fill;
+  std::vector<std::vector<double> > values;
+
+  ~CorrJob() {
+    for (size_t j = 0; j < handles.size(); ++j) if (handles[j]) bwClose(handles[j]);
+  }
+};
+
+static void open_file(CorrJob& job, size_t j) {
+  job.handles[j] = bwOpen(safe_local_path((*job.files)[j]).c_str(), NULL, "r");
+  if (!job.handles[j]) job.errors[j] = "Cannot open BigWig file: " + (*job.files)[j];
+}
+
+static void summarise_chunk(CorrJob& job, size_t j) {
+  bigWigFile_t* bw = job.handles[j];
+  const uint32_t n = (job.to - job.from + job.width - 1) / job.width;
+  if (!bw) return;
+  std::string m = match_chrom(bw, job.chrom);
+  if (m.empty()) {                      // no data for this file here
+    job.values[j].assign(n, job.stat == TILE_COVERAGE ? 0.0 : job.fill);
+    return;
+  }
+  const uint32_t tid = bwGetTid(bw, m.c_str());
+  const uint32_t to = std::min(job.to, bw->cl->len[tid]);
+  int32_t level;
+  if (to <= job.from) {
+    job.values[j].assign(n, job.stat == TILE_COVERAGE ? 0.0 : job.fill);
+  } else if (!tile_range(bw, tid, job.from, to, job.width, job.stat, job.tolerance, job.fill,
+                         job.values[j], level)) {
+    job.errors[j] = "Failed to read " + job.chrom + " from '" + (*job.files)[j] + "'.";
+  } else {
+    job.values[j].resize(n, job.stat == TILE_COVERAGE ? 0.0 : job.fill);
+  }
+}
+
+// Runs `task` for every file that hasn't failed yet.
+static void run_corr(CorrJob& job, unsigned int n_threads, void (*task)(CorrJob&, size_t)) {
+  bw_parallel_for(job.files->size(), n_threads,
+                  [&](size_t j) { if (job.errors[j].empty()) task(job, j); },
+                  [&](size_t j) {
+                    job.errors[j] = "Internal error while reading '" + (*job.files)[j] + "'.";
+                  });
+}
+
+// Pairwise-complete running sums for one pair of files, shifted by a
+// per-file constant to keep the sums of squares well conditioned.
+struct PairSums {
+  double n, sx, sy, sxx, syy, sxy;
+};
+
+class PairAccumulator {
+public:
+  explicit PairAccumulator(size_t nf)
+    : nf_(nf), shift_(nf, NA_REAL), sums_(nf * nf) {
+    PairSums z = { 0, 0, 0, 0, 0, 0 };
+    std::fill(sums_.begin(), sums_.end(), z);
+  }
+
+  // One bin: x[j] for each file, NA where missing.
+  void add(const double* x) {
+    for (size_t i = 0; i < nf_; ++i) {
+      if (std::isnan(x[i])) continue;
+      if (std::isnan(shift_[i])) shift_[i] = x[i];
+      const double a = x[i] - shift_[i];
+      for (size_t j = i + 1; j < nf_; ++j) {
+        if (std::isnan(x[j])) continue;
+        if (std::isnan(shift_[j])) shift_[j] = x[j];
+        const double b = x[j] - shift_[j];
+        PairSums& p = sums_[i * nf_ + j];
+        p.n += 1; p.sx += a; p.sy += b; p.sxx += a * a; p.syy += b * b; p.sxy += a * b;
+      }
+    }
+  }
+
+  double cor(size_t i, size_t j) const {
+    const PairSums& p = sums_[std::min(i, j) * nf_ + std::max(i, j)];
+    if (p.n < 2) return NA_REAL;
+    const double vx = p.sxx - p.sx * p.sx / p.n;
+    const double vy = p.syy - p.sy * p.sy / p.n;
+    if (!(vx > 0) || !(vy > 0)) return NA_REAL;   // a constant track
+    return (p.sxy - p.sx * p.sy / p.n) / std::sqrt(vx * vy);
+  }
+
+  double n(size_t i, size_t j) const {
+    return sums_[std::min(i, j) * nf_ + std::max(i, j)].n;
+  }
+
+private:
+  size_t nf_;
+  std::vector<double> shift_;
+  std::vector<PairSums> sums_;
+};
+
+// Average ranks (ties share their mean rank); NA stays NA. Ranks and
+// half ranks are exact in double well beyond 2^24 bins, where float would
+// round them.
+static void rank_in_place(std::vector<double>& v) {
+  std::vector<size_t> idx;
+  idx.reserve(v.size());
+  for (size_t i = 0; i < v.size(); ++i) if (!std::isnan(v[i])) idx.push_back(i);
+  std::sort(idx.begin(), idx.end(), [&v](size_t a, size_t b) { return v[a] < v[b]; });
+  for (size_t k = 0; k < idx.size();) {
+    size_t e = k + 1;
+    while (e < idx.size() && v[idx[e]] == v[idx[k]]) ++e;
+    const double r = (k + e + 1) / 2.0;   // mean of ranks k+1 .. e
+    for (size_t t = k; t < e; ++t) v[idx[t]] = r;
+    k = e;
+  }
+}
+
+// Correlation matrix of many bigWigs over fixed-width genome bins. The
+// chromosomes (of the first file that opens, or `chroms`) are cut into
+// chunks of CORR_CHUNK_BINS bins; for each chunk every file is summarised
+// concurrently on its own handle, then the bins are folded into pairwise
+// running sums, so Pearson needs constant memory. Spearman keeps one double
+// per bin and file for the ranking. Bins without data are `fill` (NA: the
+// bin is left out of that file's pairs); with `skip_zeros`, bins that are 0
+// or NA in every file are left out altogether.
+// [[Rcpp::export]]
+NumericMatrix bw_correlation_impl(std::vector<std::string> bw_files, int bin_size,
+                                  std::string method, std::string stat,
+                                  Nullable<CharacterVector> chroms, double fill,
+                                  bool skip_zeros, double tolerance, int threads) {
+  if (bin_size < 1)
+    stop("bin_size must be a positive number of bases.");
+  const bool spearman = method == "spearman";
+  if (!spearman && method != "pearson")
+    stop("Unknown method '%s'.", method.c_str());
+  TileStat st;
+  if (!parse_tile_stat(stat, st))
+    stop("Unknown statistic '%s'.", stat.c_str());
+
+  ensure_bw_init(); // on the main thread, before any worker opens a file
+
+  const size_t nf = bw_files.size();
+  CorrJob job;
+  job.files = &bw_files;
+  job.handles.assign(nf, NULL);
+  job.errors.assign(nf, std::string());
+  job.values.resize(nf);
+  job.width = static_cast<uint32_t>(bin_size);
+  job.stat = st;
+  job.tolerance = tolerance;
+  job.fill = fill;
+
+  const unsigned int n_threads = bw_thread_count(threads, nf);
+  run_corr(job, n_threads, open_file);
+
+  // The bins follow the first file that opened.
+  const bigWigFile_t* ref = NULL;
+  for (size_t j = 0; j < nf && !ref; ++j) ref = job.handles[j];
+  std::vector<std::pair<std::string, uint32_t> > plan;
+  if (ref) {
+    if (chroms.isNull()) {
+      for (uint32_t t = 0; t < ref->cl->nKeys; ++t)
+        plan.push_back(std::make_pair(std::string(ref->cl->chrom[t]), ref->cl->len[t]));
+    } else {
+      std::vector<std::string> want = as<std::vector<std::string> >(chroms.get());
+      for (size_t i = 0; i < want.size(); ++i) {
+        std::string m = match_chrom(ref, want[i]);
+        if (m.empty()) continue;
+        plan.push_back(std::make_pair(m, ref->cl->len[bwGetTid(ref, m.c_str())]));
+      }
+    }
+  }
+
+  PairAccumulator acc(nf);
+  std::vector<std::vector<double> > kept(spearman ? nf : 0);
+  std::vector<double> x(nf);
+  double n_bins = 0, n_used = 0;
+  for (size_t c = 0; c < plan.size(); ++c) {
+    const uint32_t len = plan[c].second;
+    const uint64_t step = static_cast<uint64_t>(CORR_CHUNK_BINS) * job.width;
+    for (uint64_t from = 0; from < len; from += step) {
+      checkUserInterrupt();
+      job.chrom = plan[c].first;
+      job.from = static_cast<uint32_t>(from);
+      job.to = static_cast<uint32_t>(std::min<uint64_t>(len, from + step));
+      run_corr(job, n_threads, summarise_chunk);
+
+      const uint32_t nb = (job.to - job.from + job.width - 1) / job.width;
+      n_bins += nb;
+      for (uint32_t b = 0; b < nb; ++b) {
+        bool any = false;
+        for (size_t j = 0; j < nf; ++j) {
+          x[j] = job.errors[j].empty() ? job.values[j][b] : NA_REAL;
+          if (!std::isnan(x[j]) && x[j] != 0) any = true;
+        }
+        if (skip_zeros && !any) continue;
+        n_used += 1;
+        if (spearman) {
+          for (size_t j = 0; j < nf; ++j) kept[j].push_back(x[j]);
+        } else {
+          acc.add(x.data());
+        }
+      }
+    }
+  }
+
+  // Spearman: Pearson on the ranks. Ranks are per file, over its non-NA
+  // bins, so with NA fill they are not re-ranked per pair.
+  if (spearman) {
+    for (size_t j = 0; j < nf; ++j) rank_in_place(kept[j]);
+    for (size_t b = 0; b < static_cast<size_t>(n_used); ++b) {
+      for (size_t j = 0; j < nf; ++j) x[j] = kept[j][b];
+      acc.add(x.data());
+    }
+  }
+
+  const int n = static_cast<int>(nf);
+  NumericMatrix out(n, n);
+  NumericMatrix pairs(n, n);
+  CharacterVector err(n);
+  for (int i = 0; i < n; ++i) {
+    const bool ok_i = job.errors[i].empty();
+    for (int j = 0; j < n; ++j) {
+      const bool ok = ok_i && job.errors[j].empty();
+      out(i, j) = !ok ? NA_REAL : (i == j ? 1.0 : acc.cor(i, j));
+      pairs(i, j) = ok && i != j ? acc.n(i, j) : NA_REAL;
+    }
+    if (ok_i) err[i] = NA_STRING;
+    else      err[i] = job.errors[i];
+  }
+
+  out.attr("bins") = NumericVector::create(_["total"] = n_bins, _["used"] = n_used);
+  out.attr("n") = pairs;
+  out.attr("errors") = err;
+  return out;
+}
@@ -0,0 +1,284 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bw_helpers.h"
+#include "bw_pipeline.h"
+
+using namespace Rcpp;
+
+// The parts of the genome to summarise: whole chromosomes, or one range.
+struct DistRange {
+  uint32_t tid, from, to;
+};
+
+static std::vector<DistRange> dist_ranges(bigWigFile_t* bw, const std::string& bw_file,
+                                          Nullable<CharacterVector> chroms, int start, int end) {
+  std::vector<DistRange> out;
+  if (chroms.isNull()) {
+    for (uint32_t t = 0; t < bw->cl->nKeys; ++t) {
+      DistRange r = { t, 0, bw->cl->len[t] };
+      out.push_back(r);
+    }
+    return out;
+  }
+  std::vector<std::string> want = as<std::vector<std::string> >(chroms.get());
+  for (size_t i = 0; i < want.size(); ++i) {
+    std::string m = match_chrom(bw, want[i]);
+    if (m.empty())
+      stop("Chromosome '%s' not found in '%s'.", want[i].c_str(), bw_file.c_str());
+    const uint32_t tid = bwGetTid(bw, m.c_str());
+    DistRange r = { tid, 0, bw->cl->len[tid] };
+    if (start != NA_INTEGER) {
+      if (want.size() != 1 || start < 1 || end < start || static_cast<uint32_t>(end) > r.to)
+        stop("Invalid coordinates: start must be >= 1, end >= start and within %s.",
+             want[i].c_str());
+      r.from = static_cast<uint32_t>(start - 1);
+      r.to = static_cast<uint32_t>(end);
+    }
+    out.push_back(r);
+  }
+  return out;
+}
+
+// --- Exact: base-weighted distinct values ------------------------------------
+
+// (value, bases) pairs, sorted and merged whenever the buffer doubles, so
+// memory follows the number of distinct values rather than intervals.
+class ValueCounts {
+public:
+  ValueCounts() : compacted_(0) {}
+
+  void add(float v, double bases) {
+    buf_.push_back(std::make_pair(v, bases));
+    if (buf_.size() >= std::max<size_t>(1 << 20, 2 * compacted_)) compact();
+  }
+
+  const std::vector<std::pair<float, double> >& finish() {
+    compact();
+    return buf_;
+  }
+
+private:
+  void compact() {
+    std::sort(buf_.begin(), buf_.end(),
+              [](const std::pair<float, double>& a, const std::pair<float, double>& b) {
+                return a.first < b.first;
+              });
+    size_t w = 0;
+    for (size_t i = 0; i < buf_.size(); ++i) {
+      if (w > 0 && buf_[w - 1].first == buf_[i].first) buf_[w - 1].second += buf_[i].second;
+      else buf_[w++] = buf_[i];
+    }
+    buf_.resize(w);
+    compacted_ = w;
+  }
+
+  std::vector<std::pair<float, double> > buf_;
+  size_t compacted_;
+};
+
+static void collect_exact(bigWigFile_t* bw, const std::string& bw_file, const DistRange& r,
+                          ValueCounts& vc) {
+  const bool ok = bw_stream_intervals(bw, bw->cl->chrom[r.tid], r.from, r.to,
+                                      [&](const bwOverlappingIntervals_t* iv) {
+    for (uint32_t i = 0; i < iv->l; ++i) {
+      if (std::isnan(iv->value[i])) continue;
+      const uint32_t s = std::max(iv->start[i], r.from);
+      const uint32_t e = std::min(iv->end[i], r.to);
+      if (e > s) vc.add(iv->value[i], e - s);
+    }
+  });
+  if (!ok)
+    stop("Failed to read intervals for %s in '%s'.", bw->cl->chrom[r.tid], bw_file.c_str());
+}
+
+// --- Approximate: zoom records ----------------------------------------------
+
+// One zoom record's bases, clipped to the range: all lie in [min, max] and
+// average `mean`.
+struct ZoomMass {
+  float min, max;
+  double mean, n;
+};
+
+// Without a requested level: the finest one summarising at least 1 kb per
+// record, else the coarsest there is.
+static int32_t dist_level(const bigWigFile_t* bw, int level) {
+  const int32_t nLevels = bw->hdr->nLevels;
+  if (!nLevels) stop("The file has no zoom levels; use mode = \"exact\".");
+  if (level != NA_INTEGER) {
+    if (level < 0 || level >= nLevels)
+      stop("level must be between 0 and %d.", nLevels - 1);
+    return level;
+  }
+  for (int32_t i = 0; i < nLevels; ++i)
+    if (bw->hdr->zoomHdrs->level[i] >= 1000) return i;
+  return nLevels - 1;
+}
+
+static void collect_zoom(bigWigFile_t* bw, const std::string& bw_file, const DistRange& r,
+                         int32_t level, std::vector<ZoomMass>& out) {
+  bwZoomRecords_t* z = bwGetZoomRecords(bw, level, r.tid, r.from, r.to);
+  if (!z)
+    stop("Failed to read zoom level %d for %s in '%s'.", level, bw->cl->chrom[r.tid],
+         bw_file.c_str());
+  for (uint32_t i = 0; i < z->l; ++i) {
+    if (!z->nBases[i]) continue;
+    const uint32_t s = std::max(z->start[i], r.from), e = std::min(z->end[i], r.to);
+    if (e <= s) continue;
+    // Share of the record inside the range, as in bwStats()
+    const double f = static_cast<double>(e - s) / (z->end[i] - z->start[i]);
+    ZoomMass m = { z->min[i], z->max[i], z->sum[i] / static_cast<double>(z->nBases[i]),
+                   f * z->nBases[i] };
+    out.push_back(m);
+  }
+  bwDestroyZoomRecords(z);
+}
+
+// Smallest key whose cumulative weight reaches p * total, over (key, weight)
+// pairs sorted by key (R's quantile type 1).
+template <typename Key>
+static void weighted_quantiles(const std::vector<std::pair<Key, double> >& kw, double total,
+                               const NumericVector& probs, NumericVector& out) {
+  for (R_xlen_t q = 0; q < probs.size(); ++q) {
+    if (kw.empty()) { out[q] = NA_REAL; continue; }
+    const double target = probs[q] * total;
+    double cum = 0;
+    size_t i = 0;
+    for (; i + 1 < kw.size(); ++i) {
+      cum += kw[i].second;
+      if (cum >= target) break;
+    }
+    out[q] = kw[i].first;
+  }
+}
+
+// Bin (breaks[b], breaks[b+1]], the first one closed on the left too, as in
+// hist(). Returns -1 outside the breaks.
+static R_xlen_t find_bin(const NumericVector& breaks, double v) {
+  const R_xlen_t nb = breaks.size() - 1;
+  if (v < breaks[0] || v > breaks[nb]) return -1;
+  if (v == breaks[0]) return 0;
+  return std::lower_bound(breaks.begin(), breaks.end(), v) - breaks.begin() - 1;
+}
+
+static NumericVector make_breaks(NumericVector breaks, double lo, double hi) {
+  if (breaks.size() != 1) return breaks;
+  const int n = std::max(1, static_cast<int>(breaks[0]));
+  if (!(hi > lo)) { lo -= 0.5; hi += 0.5; }
+  NumericVector out(n + 1);
+  for (int b = 0; b <= n; ++b) out[b] = lo + (hi - lo) * b / n;
+  return out;
+}
+
+// Base-weighted value distribution of a region, chromosomes or the whole
+// file: counts of bases per histogram bin and quantiles at `probs`. `breaks`
+// is either the bin edges or a single number of equal bins over the data's
+// range.
+//
+// Exact mode streams the full resolution blocks once. Approximate mode reads
+// one zoom level: quantiles are estimated from record means and bracketed by
+// bounds that hold whatever the bases inside each record are (all at the
+// record's min, or all at its max); histogram counts spread each record
+// evenly over [min, max], with `lower` (records wholly inside the bin) and
+// `upper` (also those straddling it) bracketing the true count.
+// [[Rcpp::export]]
+List bw_distribution_impl(std::string bw_file, Nullable<CharacterVector> chroms, int start, int end,
+                          NumericVector breaks, NumericVector probs, bool approx, int level) {
+  ensure_bw_init();
+  BwHandle bw(bwOpen(safe_local_path(bw_file).c_str(), NULL, "r"));
+  if (!bw.get())
+    stop("Cannot open BigWig file: %s", bw_file.c_str());
+  std::vector<DistRange> ranges = dist_ranges(bw.get(), bw_file, chroms, start, end);
+
+  NumericVector quant(probs.size()), q_lower(probs.size()), q_upper(probs.size());
+  double total = 0;
+  List out;
+
+  if (!approx) {
+    ValueCounts vc;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+      checkUserInterrupt();
+      collect_exact(bw.get(), bw_file, ranges[i], vc);
+    }
+    const std::vector<std::pair<float, double> >& kw = vc.finish();
+    for (size_t i = 0; i < kw.size(); ++i) total += kw[i].second;
+    weighted_quantiles(kw, total, probs, quant);
+
+    NumericVector br = kw.empty() ? make_breaks(breaks, 0, 1)
+                                  : make_breaks(breaks, kw.front().first, kw.back().first);
+    NumericVector counts(br.size() - 1);
+    for (size_t i = 0; i < kw.size(); ++i) {
+      const R_xlen_t b = find_bin(br, kw[i].first);
+      if (b >= 0) counts[b] += kw[i].second;
+    }
+    out = List::create(_["breaks"] = br, _["counts"] = counts, _["quantiles"] = quant,
+                       _["bases"] = total, _["distinct"] = static_cast<double>(kw.size()));
+    return out;
+  }
+
+  const int32_t lvl = dist_level(bw.get(), level);
+  std::vector<ZoomMass> zm;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    checkUserInterrupt();
+    collect_zoom(bw.get(), bw_file, ranges[i], lvl, zm);
+  }
+
+  std::vector<std::pair<double, double> > kw(zm.size());
+  double lo = HUGE_VAL, hi = -HUGE_VAL;
+  for (size_t i = 0; i < zm.size(); ++i) {
+    total += zm[i].n;
+    lo = std::min(lo, static_cast<double>(zm[i].min));
+    hi = std::max(hi, static_cast<double>(zm[i].max));
+  }
+  std::vector<std::pair<double, double> >::iterator kb = kw.begin();
+  for (size_t i = 0; i < zm.size(); ++i, ++kb) *kb = std::make_pair(zm[i].mean, zm[i].n);
+  std::sort(kw.begin(), kw.end());
+  weighted_quantiles(kw, total, probs, quant);
+  for (size_t i = 0; i < zm.size(); ++i) kw[i] = std::make_pair(zm[i].min, zm[i].n);
+  std::sort(kw.begin(), kw.end());
+  weighted_quantiles(kw, total, probs, q_lower);
+  for (size_t i = 0; i < zm.size(); ++i) kw[i] = std::make_pair(zm[i].max, zm[i].n);
+  std::sort(kw.begin(), kw.end());
+  weighted_quantiles(kw, total, probs, q_upper);
+
+  NumericVector br = zm.empty() ? make_breaks(breaks, 0, 1) : make_breaks(breaks, lo, hi);
+  const R_xlen_t nb = br.size() - 1;
+  NumericVector counts(nb), lower(nb), upper(nb);
+  for (size_t i = 0; i < zm.size(); ++i) {
+    const ZoomMass& m = zm[i];
+    const R_xlen_t b0 = find_bin(br, m.min), b1 = find_bin(br, m.max);
+    if (b0 >= 0 && b0 == b1) {
+      counts[b0] += m.n;
+      lower[b0] += m.n;
+      upper[b0] += m.n;
+      continue;
+    }
+    // Straddles bin edges (or the ends of the breaks): spread evenly.
+    const double width = static_cast<double>(m.max) - m.min;
+    if (!(width > 0)) continue; // a single value outside the breaks
+    for (R_xlen_t b = std::max<R_xlen_t>(b0, 0); b < nb && br[b] <= m.max; ++b) {
+      const double s = std::max(br[b], static_cast<double>(m.min));
+      const double e = std::min(br[b + 1], static_cast<double>(m.max));
+      if (e < s || (e == s && b != b0)) continue;
+      counts[b] += m.n * (e - s) / width;
+      upper[b] += m.n;
+    }
+  }
+
+  // Quantile error: half the width of the guaranteed bracket.
+  NumericVector err(probs.size());
+  for (R_xlen_t q = 0; q < probs.size(); ++q) err[q] = (q_upper[q] - q_lower[q]) / 2;
+
+  out = List::create(_["breaks"] = br, _["counts"] = counts, _["lower"] = lower,
+                     _["upper"] = upper, _["quantiles"] = quant, _["quantile_lower"] = q_lower,
+                     _["quantile_upper"] = q_upper, _["quantile_error"] = err,
+                     _["bases"] = total, _["level"] = lvl,
+                     _["resolution"] = static_cast<double>(bw.get()->hdr->zoomHdrs->level[lvl]));
+  return out;
+}
@@ -0,0 +1,177 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+#include "bw_pipeline.h"
+
+using namespace Rcpp;
+
+// One point of the downsampled track; pos is 0-based.
+struct PlotPoint {
+  uint32_t pos;
+  double value;
+};
+
+static bool by_pos(const PlotPoint& a, const PlotPoint& b) { return a.pos < b.pos; }
+
+// Calls f(pixel, s, e, value) for every non-NA run of `rle` (which starts at
+// qStart) cut at pixel boundaries, in position order. Pixel i covers
+// [qStart + w*i/n, qStart + w*(i+1)/n), as bw_stats() splits its bins.
+template <typename F>
+static void for_each_piece(const RleBuilder& rle, uint32_t qStart, uint32_t width, int n, F f) {
+  int px = 0;
+  uint32_t px_end = qStart + static_cast<uint32_t>(static_cast<uint64_t>(width) / n);
+  uint32_t s = qStart;
+  for (size_t r = 0; r < rle.lengths.size(); ++r) {
+    const uint32_t e = s + static_cast<uint32_t>(rle.lengths[r]);
+    const double v = rle.values[r];
+    for (uint32_t a = s; a < e; ) {
+      while (a >= px_end) {
+        ++px;
+        px_end = qStart + static_cast<uint32_t>(static_cast<uint64_t>(width) * (px + 1) / n);
+      }
+      const uint32_t b = std::min(e, px_end);
+      if (!std::isnan(v)) f(px, a, b, v);
+      a = b;
+    }
+    s = e;
+  }
+}
+
+// M4: the first, last, minimum and maximum point of each pixel, which is
+// enough to draw the pixel column exactly as the full data would.
+struct M4Pixel {
+  bool any;
+  PlotPoint first, last, min, max;
+};
+
+static std::vector<PlotPoint> downsample_m4(const RleBuilder& rle, uint32_t qStart,
+                                            uint32_t width, int n) {
+  M4Pixel empty = { false, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } };
+  std::vector<M4Pixel> px(n, empty);
+  for_each_piece(rle, qStart, width, n, [&](int i, uint32_t s, uint32_t e, double v) {
+    M4Pixel& p = px[i];
+    PlotPoint head = { s, v }, tail = { e - 1, v };
+    if (!p.any) {
+      p.any = true;
+      p.first = p.min = p.max = head;
+    } else {
+      if (v < p.min.value) p.min = head;
+      if (v > p.max.value) p.max = head;
+    }
+    p.last = tail;
+  });
+
+  std::vector<PlotPoint> out;
+  for (int i = 0; i < n; ++i) {
+    if (!px[i].any) continue;
+    PlotPoint four[4] = { px[i].first, px[i].min, px[i].max, px[i].last };
+    std::sort(four, four + 4, by_pos);
+    for (int k = 0; k < 4; ++k)
+      if (out.empty() || out.back().pos != four[k].pos) out.push_back(four[k]);
+  }
+  return out;
+}
+
+// Largest-Triangle-Three-Buckets with one bucket per pixel, plus the first
+// and last points. Within a run the triangle area is linear in the
+// position, so only run ends (cut at pixel boundaries) are candidates.
+static std::vector<PlotPoint> downsample_lttb(const RleBuilder& rle, uint32_t qStart,
+                                              uint32_t width, int n) {
+  std::vector<double> sx(n, 0.0), sy(n, 0.0), cnt(n, 0.0);
+  std::vector<std::vector<PlotPoint> > cand(n);
+  for_each_piece(rle, qStart, width, n, [&](int i, uint32_t s, uint32_t e, double v) {
+    const double len = e - s;
+    sx[i] += (static_cast<double>(s) + (e - 1)) / 2 * len;
+    sy[i] += v * len;
+    cnt[i] += len;
+    PlotPoint head = { s, v }, tail = { e - 1, v };
+    cand[i].push_back(head);
+    if (e - 1 > s) cand[i].push_back(tail);
+  });
+
+  int first = 0, last = n - 1;
+  while (first < n && cand[first].empty()) ++first;
+  while (last >= 0 && cand[last].empty()) --last;
+  std::vector<PlotPoint> out;
+  if (first > last) return out;
+
+  PlotPoint a = cand[first].front();
+  const PlotPoint end_pt = cand[last].back();
+  out.push_back(a);
+  int next = first;
+  for (int i = first; i <= last; ++i) {
+    if (cand[i].empty()) continue;
+    // The next bucket's average, or the last point after the last bucket.
+    if (next <= i) {
+      next = i + 1;
+      while (next <= last && cand[next].empty()) ++next;
+    }
+    double cx, cy;
+    if (next <= last) { cx = sx[next] / cnt[next]; cy = sy[next] / cnt[next]; }
+    else              { cx = end_pt.pos;           cy = end_pt.value; }
+
+    const PlotPoint* best = &cand[i].front();
+    double best_area = -1;
+    for (size_t k = 0; k < cand[i].size(); ++k) {
+      const PlotPoint& p = cand[i][k];
+      const double area = std::fabs((a.pos - cx) * (p.value - a.value) -
+                                    (a.pos - static_cast<double>(p.pos)) * (cy - a.value));
+      if (area > best_area) { best_area = area; best = &p; }
+    }
+    a = *best;
+    if (a.pos != out.back().pos) out.push_back(a);
+  }
+  if (end_pt.pos != out.back().pos) out.push_back(end_pt);
+  return out;
+}
+
+// Plot-oriented downsampling of [start, end] on `chrom` to about `pixels`
+// columns: "m4" keeps the first, last, min and max point of every pixel
+// (exact envelope, so narrow spikes survive), "lttb" one visually salient
+// point per pixel. Works on the decoded intervals as runs, never on a dense
+// vector. Returns a data.frame of 1-based positions and values.
+// [[Rcpp::export]]
+List bw_downsample_impl(std::string bw_file, std::string chrom, int start, int end,
+                        int pixels, std::string method, double fill) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+  if (pixels < 1)
+    stop("pixels must be a positive number.");
+  if (method != "m4" && method != "lttb")
+    stop("Unknown method '%s'.", method.c_str());
+
+  std::string chrom_match;
+  BwHandle bw(open_bw_chrom(bw_file, chrom, chrom_match));
+
+  const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
+  const uint32_t width  = qEnd - qStart;
+  const int n = static_cast<int>(std::min<uint32_t>(static_cast<uint32_t>(pixels), width));
+
+  RleBuilder rle(width, fill);
+  if (!bw_stream_intervals(bw.get(), chrom_match, qStart, qEnd,
+                           [&](const bwOverlappingIntervals_t* iv) { rle.push(iv, qStart, qEnd); }))
+    stop("Failed to read intervals for %s:%d-%d in '%s'.",
+         chrom.c_str(), start, end, bw_file.c_str());
+  rle.finish();
+
+  std::vector<PlotPoint> pts = method == "m4" ? downsample_m4(rle, qStart, width, n)
+                                              : downsample_lttb(rle, qStart, width, n);
+
+  const int np = static_cast<int>(pts.size());
+  IntegerVector pos(no_init(np));
+  NumericVector value(no_init(np));
+  for (int i = 0; i < np; ++i) {
+    pos[i] = static_cast<int>(pts[i].pos) + 1;
+    value[i] = pts[i].value;
+  }
+  List out = List::create(_["pos"] = pos, _["value"] = value);
+  out.attr("class") = "data.frame";
+  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -np);
+  return out;
+}
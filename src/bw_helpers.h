@@ -0,0 +1,148 @@
+#ifndef BWIMPORT_HELPERS_H
+#define BWIMPORT_HELPERS_H
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+  #include "bigWig.h"
+}
+
+// Shared between the .cpp entry points; defined in bw_import.cpp.
+
+// One-time libBigWig initialisation (reset by bw_cleanup()).
+void ensure_bw_init();
+
+// Windows-safe local path; URLs pass through untouched.
+std::string safe_local_path(const std::string& path);
+
+// Resolve `chrom` against the file's chromosome list, tolerating a missing
+// or extra "chr" prefix. Returns "" if there is no match.
+std::string match_chrom(const bigWigFile_t* bw, const std::string& chrom);
+
+// Open a bigWig for reading and resolve `chrom`, calling Rcpp::stop() with the
+// same messages as bw_import() on failure. The caller owns the handle.
+bigWigFile_t* open_bw_chrom(const std::string& bw_file, const std::string& chrom,
+                            std::string& chrom_match);
+
+// As open_bw_chrom(), but returns NULL and sets `err` instead of throwing, and
+// touches no R API, so it is safe on worker threads. ensure_bw_init() must
+// already have run on the main thread.
+bigWigFile_t* try_open_bw_chrom(const std::string& bw_file, const std::string& chrom,
+                                std::string& chrom_match, std::string& err);
+
+// Conversion of a stored bigWig value to an output element type. Integers
+// are rounded to nearest; values outside int range become NA.
+template <typename T> struct BwValue;
+template <> struct BwValue<double> {
+  static double from(float v) { return static_cast<double>(v); }
+};
+template <> struct BwValue<float> {
+  static float from(float v) { return v; }
+};
+template <> struct BwValue<int> {
+  static int from(float v) {
+    double r = std::floor(static_cast<double>(v) + 0.5);
+    return (r > INT_MAX || r <= INT_MIN) ? INT_MIN : static_cast<int>(r); // INT_MIN is R's NA
+  }
+  // True if v converts without loss.
+  static bool exact(float v) {
+    return v == std::floor(v) && v < 2147483648.0f && v > -2147483648.0f;
+  }
+};
+
+// Paint intervals into out[0 .. qEnd-qStart), clipping to [qStart, qEnd) and
+// mapping NaN values to `fill` (0 in bw_import()). Unpainted bases are left
+// alone. Instantiated per output type so each is a plain fill loop.
+template <typename T>
+void paint_intervals(const bwOverlappingIntervals_t* iv, uint32_t qStart, uint32_t qEnd,
+                     T* out, T fill) {
+  for (uint32_t i = 0; i < iv->l; ++i) {
+    uint32_t s = iv->start[i];
+    uint32_t e = iv->end[i];
+    if (e <= qStart || s >= qEnd) continue;
+
+    uint32_t paintStart = std::max(s, qStart);
+    uint32_t paintEnd   = std::min(e, qEnd);
+
+    T v = std::isnan(iv->value[i]) ? fill : BwValue<T>::from(iv->value[i]);
+    std::fill(out + (paintStart - qStart), out + (paintEnd - qStart), v);
+  }
+}
+
+// Accumulates (value, length) runs over [0, len), merging equal neighbours
+// and filling gaps with `fill`. Intervals must arrive sorted by start; where
+// they overlap the later one wins, as when painting densely.
+class RleBuilder {
+public:
+  RleBuilder(uint32_t len, double fill) : len_(len), pos_(0), fill_(fill) {}
+
+  // s, e are relative to the query start and already clipped to it.
+  void push(uint32_t s, uint32_t e, double v) {
+    if (e <= s) return;
+    // Overlaps only occur in malformed files: unwind back to s, keeping
+    // whatever lies past e to re-append afterwards.
+    std::vector<std::pair<double, uint32_t> > tail;
+    while (s < pos_) {
+      uint32_t n = static_cast<uint32_t>(lengths.back());
+      uint32_t from = pos_ - n > s ? pos_ - n : s;
+      if (pos_ > e) tail.push_back(std::make_pair(values.back(), pos_ - (from > e ? from : e)));
+      if (from == pos_ - n) { values.pop_back(); lengths.pop_back(); }
+      else lengths.back() -= static_cast<int>(pos_ - from);
+      pos_ = from;
+    }
+    if (s > pos_) append(fill_, s - pos_);
+    append(v != v ? fill_ : v, e - s);
+    pos_ = e;
+    for (size_t i = tail.size(); i-- > 0; ) {
+      append(tail[i].first, tail[i].second);
+      pos_ += tail[i].second;
+    }
+  }
+
+  void push(const bwOverlappingIntervals_t* iv, uint32_t qStart, uint32_t qEnd) {
+    for (uint32_t i = 0; i < iv->l; ++i) {
+      if (iv->end[i] <= qStart || iv->start[i] >= qEnd) continue;
+      push((iv->start[i] > qStart ? iv->start[i] : qStart) - qStart,
+           (iv->end[i] < qEnd ? iv->end[i] : qEnd) - qStart, iv->value[i]);
+    }
+  }
+
+  // Pad to the full length; call once before reading values/lengths.
+  void finish() {
+    if (pos_ < len_) append(fill_, len_ - pos_);
+    pos_ = len_;
+  }
+
+  std::vector<double> values;
+  std::vector<int> lengths;
+
+private:
+  void append(double v, uint32_t n) {
+    if (!values.empty() && same(values.back(), v)) lengths.back() += n;
+    else { values.push_back(v); lengths.push_back(static_cast<int>(n)); }
+  }
+  // NaN (including NA) runs merge with each other.
+  static bool same(double a, double b) { return a == b || (a != a && b != b); }
+
+  uint32_t len_, pos_;
+  double fill_;
+};
+
+// Closes the handle when it goes out of scope, so Rcpp::stop() can't leak it.
+class BwHandle {
+public:
+  explicit BwHandle(bigWigFile_t* bw) : bw_(bw) {}
+  ~BwHandle() { if (bw_) bwClose(bw_); }
+  bigWigFile_t* get() const { return bw_; }
+private:
+  bigWigFile_t* bw_;
+  BwHandle(const BwHandle&);
+  BwHandle& operator=(const BwHandle&);
+};
+
+#endif // BWIMPORT_HELPERS_H
@@ -4,13 +4,20 @@
 #include <cstring>
 #include <algorithm>
 #include <atomic>
+#include <string>
+#include <vector>
 
 #ifdef _WIN32
 #include <windows.h>  // for GetShortPathNameA
 #endif
 
+#include "bw_async.h"
+#include "bw_cache.h"
+#include "bw_helpers.h"
+#include "bw_pipeline.h"
+#include "bw_pool.h"
+
 extern "C" {
-  #include "bigWig.h"
   #include <R_ext/Rdynload.h>
 }
 
@@ -20,7 +27,7 @@ using namespace Rcpp;
 // FIX: single atomic flag at file scope — no shadowing
 static std::atomic<bool> bw_ready(false);
 
-inline void ensure_bw_init() {
+void ensure_bw_init() {
   // FIX: removed the local `static std::atomic<bool> bw_ready` that was
   //      shadowing the file-scope variable. bw_cleanup() and R_unload_bwimport()
   //      reset the file-scope bw_ready, so the guard must use the same variable.
@@ -39,6 +46,7 @@ inline void ensure_bw_init() {
       bw_ready.store(false);
       Rcpp::stop("Failed to initialize libBigWig.");
     }
+    bwSetReadCache(bw_cache_hooks());  // serve bw_prefetch()ed ranges from memory
   }
 }
 
@@ -75,7 +83,7 @@ inline bool starts_with_ci(const std::string& s, const char* prefix) {
 // caused a ~50s hang per file). Now on Windows: only LOCAL paths get
 // the slash-swap + 8.3-short-name treatment; URLs are returned as-is
 // so libBigWig's libcurl-backed URL open receives a well-formed URL.
-inline std::string safe_local_path(const std::string& path) {
+std::string safe_local_path(const std::string& path) {
 #ifdef _WIN32
   // URL -> pass through untouched; libBigWig+libcurl handle these.
   if (starts_with_ci(path, "http://")  ||
@@ -106,22 +114,7 @@ inline std::string safe_local_path(const std::string& path) {
 }
 
 
-// [[Rcpp::export]]
-NumericVector bw_import_impl(std::string bw_file, std::string chrom, int start, int end) {
-  if (start < 1 || end < start)
-    stop("Invalid coordinates: start must be >= 1 and end >= start.");
-
-  ensure_bw_init();
-
-  // FIX: sanitise local paths on Windows before handing to libBigWig
-  std::string open_path = safe_local_path(bw_file);
-
-  bigWigFile_t* bw = bwOpen(open_path.c_str(), NULL, "r");
-  if (!bw)
-    stop("Cannot open BigWig file: %s", bw_file.c_str());
-
-  // --- Chromosome name matching (handles both 'chr12' <-> '12') ---
-  std::string chrom_match = "";
+std::string match_chrom(const bigWigFile_t* bw, const std::string& chrom) {
   std::string chrom_stripped = strip_chr_prefix(chrom);
 
   if (bw->cl && bw->cl->nKeys > 0) {
@@ -129,11 +122,27 @@ NumericVector bw_import_impl(std::string bw_file, std::string chrom, int start,
       std::string bw_chrom = bw->cl->chrom[i];
       std::string bw_chrom_stripped = strip_chr_prefix(bw_chrom);
       if (chrom == bw_chrom || chrom_stripped == bw_chrom_stripped) {
-        chrom_match = bw_chrom;
-        break;
+        return bw_chrom;
       }
     }
   }
+  return "";
+}
+
+
+bigWigFile_t* try_open_bw_chrom(const std::string& bw_file, const std::string& chrom,
+                                std::string& chrom_match, std::string& err) {
+  // FIX: sanitise local paths on Windows before handing to libBigWig
+  std::string open_path = safe_local_path(bw_file);
+
+  bigWigFile_t* bw = bwOpen(open_path.c_str(), NULL, "r");
+  if (!bw) {
+    err = "Cannot open BigWig file: " + bw_file;
+    return NULL;
+  }
+
+  // --- Chromosome name matching (handles both 'chr12' <-> '12') ---
+  chrom_match = match_chrom(bw, chrom);
 
   if (chrom_match.empty()) {
     std::string available = "";
@@ -145,48 +154,239 @@ NumericVector bw_import_impl(std::string bw_file, std::string chrom, int start,
       if (bw->cl->nKeys > 5) available += ", ...";
     }
     bwClose(bw);
-    stop("Chromosome '%s' not found in BigWig file '%s'. Available examples: [%s]",
-         chrom.c_str(), bw_file.c_str(), available.c_str());
+    err = "Chromosome '" + chrom + "' not found in BigWig file '" + bw_file +
+          "'. Available examples: [" + available + "]";
+    return NULL;
+  }
+  return bw;
+}
+
+
+bigWigFile_t* open_bw_chrom(const std::string& bw_file, const std::string& chrom,
+                            std::string& chrom_match) {
+  ensure_bw_init();
+
+  std::string err;
+  bigWigFile_t* bw = try_open_bw_chrom(bw_file, chrom, chrom_match, err);
+  if (!bw)
+    stop(err);
+  return bw;
+}
+
+
+// --- chunked dense import -----------------------------------------------------
+// Dense imports of at least this many bases are split over threads.
+static const uint32_t CHUNKED_MIN_BASES = 1u << 22;
+// Full resolution blocks (R-tree leaf entries) per task: small enough that
+// dense and sparse stretches of a chromosome even out across threads.
+static const uint64_t CHUNK_BLOCKS = 32;
+
+// Worker threads only see plain C++ data; see bw_pool.h. Chunk k is
+// blocks [first[k], first[k+1]) and owns output bases [bound[k], bound[k+1]),
+// so threads write disjoint slices. All of them read through the calling
+// thread's handle, which is safe to share (see bwReadAt()). Within a chunk,
+// blocks that lie back to back are fetched in one read (one range request
+// for remote files), as in bw_pipeline_blocks().
+struct ChunkJob {
+  bigWigFile_t* bw;
+  uint32_t tid, qStart;
+  double fill;
+  double* out;
+  const bwBlockList_t* blocks;
+  std::vector<uint64_t> first;
+  std::vector<uint32_t> bound;
+  std::atomic<bool> failed;
+};
+
+static bool import_chunk(ChunkJob& job, size_t k) {
+  const uint32_t from = job.bound[k], to = job.bound[k + 1];
+  double* slice = job.out + (from - job.qStart);
+  std::fill(slice, slice + (to - from), job.fill);
+  const bwBlockList_t* blocks = job.blocks;
+  std::vector<unsigned char> raw, buf;
+  for (uint64_t b = job.first[k]; b < job.first[k + 1]; ) {
+    uint64_t bytes;
+    const uint64_t n = bw_run_blocks(blocks, b, job.first[k + 1], &bytes);
+    raw.resize(bytes);
+    if (bwFetchBlocks(job.bw, blocks, b, n, raw.data()) != 0) return false;
+    size_t at = 0;
+    for (uint64_t j = b; j < b + n; ++j) {
+      uint64_t size;
+      buf.resize(job.bw->hdr->bufSize ? job.bw->hdr->bufSize : blocks->size[j]);
+      if (bwInflateBlock(job.bw, raw.data() + at, blocks->size[j], buf.data(), &size) != 0) return false;
+      bwOverlappingIntervals_t* iv = bwDecodeBlock(buf.data(), size, job.tid, blocks->start[j], blocks->end[j]);
+      if (!iv) return false;
+      paint_intervals(iv, from, to, slice, job.fill);
+      bwDestroyOverlappingIntervals(iv);
+      at += blocks->size[j];
+    }
+    b += n;
+  }
+  return true;
+}
+
+// Paint [qStart, qEnd) into `out` using up to `n_threads` threads. Returns
+// false if the region is too small or has too few blocks to be worth
+// splitting (nothing has been written then); stops on read errors.
+static bool import_dense_chunked(bigWigFile_t* bw, const std::string& bw_file,
+                                 const std::string& chrom_match, uint32_t qStart, uint32_t qEnd,
+                                 double fill, double* out, unsigned int n_threads) {
+  if (n_threads < 2 || qEnd - qStart < CHUNKED_MIN_BASES) return false;
+  const uint32_t tid = bwGetTid(bw, chrom_match.c_str());
+  bwBlockList_t* blocks = bwGetBlockList(bw, tid, qStart, qEnd);
+  if (!blocks || blocks->n <= CHUNK_BLOCKS) {
+    if (blocks) bwDestroyBlockList(blocks);
+    return false;
   }
 
+  ChunkJob job;
+  job.bw = bw;
+  job.tid = tid;
+  job.qStart = qStart;
+  job.fill = fill;
+  job.out = out;
+  job.blocks = blocks;
+  for (uint64_t b = 0; b < blocks->n; b += CHUNK_BLOCKS) {
+    job.first.push_back(b);
+    const uint32_t from = b == 0 ? qStart : std::min(qEnd, blocks->start[b]);
+    job.bound.push_back(std::max(from, job.bound.empty() ? qStart : job.bound.back()));
+  }
+  job.first.push_back(blocks->n);
+  job.bound.push_back(qEnd);
+  job.failed = false;
+
+  const size_t n_chunks = job.first.size() - 1;
+  // Chunks are handed out one at a time, so a thread stuck on a dense
+  // stretch simply takes fewer of them; after a failure the rest are skipped.
+  bw_parallel_for(n_chunks, std::min<unsigned int>(n_threads, static_cast<unsigned int>(n_chunks)),
+                  [&](size_t k) { if (!job.failed && !import_chunk(job, k)) job.failed = true; },
+                  [&](size_t) { job.failed = true; });
+  bwDestroyBlockList(blocks);
+
+  if (job.failed)
+    stop("Failed to read intervals for %s:%u-%u in '%s'.",
+         chrom_match.c_str(), qStart + 1, qEnd, bw_file.c_str());
+  return true;
+}
+
+// [[Rcpp::export]]
+NumericVector bw_import_impl(std::string bw_file, std::string chrom, int start, int end,
+                             double fill = 0.0, int threads = 1) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+
+  std::string chrom_match;
+  BwHandle bw(open_bw_chrom(bw_file, chrom, chrom_match));
+
   // --- Query region ---
   const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
   const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
 
   const int out_len = end - start + 1;
-  NumericVector out(out_len, 0.0);
-
-  bwOverlappingIntervals_t* iv = bwGetOverlappingIntervals(bw, chrom_match.c_str(), qStart, qEnd);
-  if (iv) {
-    for (uint32_t i = 0; i < iv->l; ++i) {
-      uint32_t s = iv->start[i];
-      uint32_t e = iv->end[i];
-      if (e <= qStart || s >= qEnd) continue;
-
-      uint32_t paintStart = std::max(s, qStart);
-      uint32_t paintEnd   = std::min(e, qEnd);
-
-      for (uint32_t p = paintStart; p < paintEnd; ++p) {
-        int idx = static_cast<int>(p - qStart);
-        double v = iv->value[i];
-        out[idx] = std::isnan(v) ? 0.0 : v;
-      }
-    }
-    bwDestroyOverlappingIntervals(iv);
+
+  // Large regions: fetch, inflate and paint block chunks on worker threads
+  // (threads <= 0: one per core).
+  NumericVector out(no_init(out_len));
+  if (import_dense_chunked(bw.get(), bw_file, chrom_match, qStart, qEnd, fill, out.begin(),
+                           bw_thread_count(threads, qEnd - qStart)))
+    return out;
+
+  // Otherwise one stream, with fetch and inflate running ahead of painting.
+  std::fill(out.begin(), out.end(), fill);
+  if (!bw_stream_intervals(bw.get(), chrom_match, qStart, qEnd,
+                           [&](const bwOverlappingIntervals_t* iv) {
+                             paint_intervals(iv, qStart, qEnd, out.begin(), fill);
+                           }))
+    stop("Failed to read intervals for %s:%d-%d in '%s'.",
+         chrom.c_str(), start, end, bw_file.c_str());
+  return out;
+}
+
+// Run-length encoded import: the runs are built straight from the decoded
+// blocks, so memory scales with the number of intervals, not bases.
+// [[Rcpp::export]]
+List bw_import_rle_impl(std::string bw_file, std::string chrom, int start, int end, double fill) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+
+  std::string chrom_match;
+  BwHandle bw(open_bw_chrom(bw_file, chrom, chrom_match));
+
+  const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
+
+  RleBuilder rle(qEnd - qStart, fill);
+  if (!bw_stream_intervals(bw.get(), chrom_match, qStart, qEnd,
+                           [&](const bwOverlappingIntervals_t* iv) { rle.push(iv, qStart, qEnd); }))
+    stop("Failed to read intervals for %s:%d-%d in '%s'.",
+         chrom.c_str(), start, end, bw_file.c_str());
+  rle.finish();
+
+  List out = List::create(
+    _["lengths"] = IntegerVector(rle.lengths.begin(), rle.lengths.end()),
+    _["values"]  = NumericVector(rle.values.begin(), rle.values.end())
+  );
+  out.attr("class") = "rle";
+  return out;
+}
+
+// Interval import: the file's own bedGraph-style records, clipped to the
+// query, as a data.frame with 1-based inclusive start/end like bw_import()'s
+// arguments. Columns are allocated once at the final size.
+// [[Rcpp::export]]
+List bw_import_intervals_impl(std::string bw_file, std::string chrom, int start, int end,
+                              double fill) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+
+  std::string chrom_match;
+  BwHandle bw(open_bw_chrom(bw_file, chrom, chrom_match));
+
+  const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
+
+  bwOverlappingIntervals_t* iv = bwGetOverlappingIntervals(bw.get(), chrom_match.c_str(), qStart, qEnd);
+  if (!iv)
+    stop("Failed to read intervals for %s:%d-%d in '%s'.",
+         chrom.c_str(), start, end, bw_file.c_str());
+
+  R_xlen_t n = 0;
+  for (uint32_t i = 0; i < iv->l; ++i)
+    if (iv->end[i] > qStart && iv->start[i] < qEnd) ++n;
+
+  IntegerVector out_start(no_init(n)), out_end(no_init(n));
+  NumericVector out_value(no_init(n));
+  R_xlen_t k = 0;
+  for (uint32_t i = 0; i < iv->l; ++i) {
+    if (iv->end[i] <= qStart || iv->start[i] >= qEnd) continue;
+    out_start[k] = static_cast<int>(std::max(iv->start[i], qStart)) + 1;
+    out_end[k]   = static_cast<int>(std::min(iv->end[i], qEnd));
+    out_value[k] = std::isnan(iv->value[i]) ? fill : static_cast<double>(iv->value[i]);
+    ++k;
   }
+  bwDestroyOverlappingIntervals(iv);
 
-  bwClose(bw);
+  List out = List::create(_["start"] = out_start, _["end"] = out_end, _["value"] = out_value);
+  out.attr("class") = "data.frame";
+  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -static_cast<int>(n));
   return out;
 }
 
+// Background queries are cancelled and their workers joined first: they
+// read through libBigWig. The block cache is emptied too.
 // [[Rcpp::export]]
 void bw_cleanup() {
+  bw_executor().stop();
+  bw_cache().clear();
   bwCleanup();
   bw_ready.store(false);  // now correctly resets the SAME flag ensure_bw_init() checks
 }
 
 // --- Cleanup hook: called when the DLL/SO unloads ---------------------------
 extern "C" void R_unload_bwimport(DllInfo* /*dll*/) {
+  bw_executor().stop();
+  bwSetReadCache(NULL);
+  bw_cache().clear();
   bwCleanup();
   bw_ready.store(false);
 }
@@ -0,0 +1,86 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+#include "bw_pool.h"
+
+using namespace Rcpp;
+
+// Worker threads only see plain C++ data: file names in, a raw column pointer
+// and an error string out. Everything R-facing happens before and after.
+struct MatrixJob {
+  const std::vector<std::string>* files;
+  std::string chrom;
+  uint32_t qStart, qEnd;
+  double fill;
+  double* data;                 // column-major, (qEnd - qStart) rows
+  std::vector<std::string>* errors;
+};
+
+static void import_column(MatrixJob& job, size_t j) {
+  const size_t nrow = job.qEnd - job.qStart;
+  double* col = job.data + j * nrow;
+  std::string& err = (*job.errors)[j];
+
+  std::string chrom_match;
+  bigWigFile_t* bw = try_open_bw_chrom((*job.files)[j], job.chrom, chrom_match, err);
+  bwOverlappingIntervals_t* iv = NULL;
+  if (bw) {
+    iv = bwGetOverlappingIntervals(bw, chrom_match.c_str(), job.qStart, job.qEnd);
+    if (!iv) err = "Failed to read intervals from '" + (*job.files)[j] + "'.";
+  }
+  if (iv) {
+    std::fill(col, col + nrow, job.fill);
+    paint_intervals(iv, job.qStart, job.qEnd, col, job.fill);
+    bwDestroyOverlappingIntervals(iv);
+  } else {
+    std::fill(col, col + nrow, NA_REAL);
+  }
+  if (bw) bwClose(bw);
+}
+
+// One region from many files, each file's track written straight into its own
+// column. Files are opened and read concurrently on `threads` threads (<= 0:
+// one per core). A file that can't be opened, lacks the chromosome or fails
+// to read gets an NA column; the reasons are in attr(, "errors").
+// [[Rcpp::export]]
+NumericMatrix bw_import_matrix_impl(std::vector<std::string> bw_files, std::string chrom,
+                                    int start, int end, double fill, int threads) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+
+  ensure_bw_init(); // on the main thread, before any worker opens a file
+
+  const int nrow = end - start + 1;
+  const int ncol = static_cast<int>(bw_files.size());
+  NumericMatrix out(no_init(nrow, ncol));
+  std::vector<std::string> errors(bw_files.size());
+
+  MatrixJob job;
+  job.files = &bw_files;
+  job.chrom = chrom;
+  job.qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  job.qEnd = static_cast<uint32_t>(end);         // 0-based exclusive
+  job.fill = fill;
+  job.data = out.begin();
+  job.errors = &errors;
+
+  bw_parallel_for(bw_files.size(), bw_thread_count(threads, bw_files.size()),
+                  [&](size_t j) { import_column(job, j); },
+                  [&](size_t j) {
+                    errors[j] = "Internal error while reading '" + bw_files[j] + "'.";
+                    const size_t nr = job.qEnd - job.qStart;
+                    std::fill(job.data + j * nr, job.data + (j + 1) * nr, NA_REAL);
+                  });
+
+  CharacterVector err(ncol);
+  for (int j = 0; j < ncol; ++j) {
+    if (errors[j].empty()) err[j] = NA_STRING;
+    else                   err[j] = errors[j];
+  }
+  out.attr("errors") = err;
+  return out;
+}
@@ -0,0 +1,277 @@
+#ifndef BWIMPORT_PIPELINE_H
+#define BWIMPORT_PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+extern "C" {
+  #include "bigWig.h"
+}
+
+// Streaming read of one query in three overlapping stages: an I/O thread
+// fetching blocks ahead of need, an inflate thread, and the calling thread,
+// which decodes each block and hands its intervals on in file order. While
+// one block is being inflated the next ones are already on their way, so a
+// long remote read takes about as long as the slower of network and CPU
+// rather than their sum. The stage threads touch no R API and share the
+// caller's handle (reads are positional, see bwReadAt()).
+
+// Bounded single-producer single-consumer queue between two stages. Push
+// and pop are lock-free; a side that finds the queue full (or empty) spins
+// briefly, then sleeps until the other side moves. close() ends the stream
+// from either end: pushes fail from then on, and pops once the queue is
+// drained.
+template <typename T>
+class BwRing {
+public:
+  explicit BwRing(size_t capacity)
+    : slots_(capacity), head_(0), tail_(0), closed_(false), sleepers_(0) {}
+
+  bool push(T& v) {
+    wait([&] { return closed_.load() || tail_.load() - head_.load() < slots_.size(); });
+    if (closed_.load()) return false;
+    const size_t t = tail_.load();
+    slots_[t % slots_.size()] = std::move(v);
+    tail_.store(t + 1);
+    wake();
+    return true;
+  }
+
+  bool pop(T& v) {
+    wait([&] { return head_.load() != tail_.load() || closed_.load(); });
+    const size_t h = head_.load();
+    if (h == tail_.load()) return false;   // closed and drained
+    v = std::move(slots_[h % slots_.size()]);
+    head_.store(h + 1);
+    wake();
+    return true;
+  }
+
+  void close() {
+    closed_.store(true);
+    wake();
+  }
+
+private:
+  // The sleeper count and the positions are sequentially consistent, so
+  // either the sleeper sees the other side's move or that side sees the
+  // sleeper and wakes it.
+  template <typename Ready>
+  void wait(Ready ready) {
+    for (int i = 0; i < 64; ++i) {
+      if (ready()) return;
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleepers_.fetch_add(1);
+    cv_.wait(lock, ready);
+    sleepers_.fetch_sub(1);
+  }
+
+  void wake() {
+    if (sleepers_.load() == 0) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_all();
+  }
+
+  std::vector<T> slots_;
+  std::atomic<size_t> head_, tail_;
+  std::atomic<bool> closed_;
+  std::atomic<int> sleepers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  BwRing(const BwRing&);
+  BwRing& operator=(const BwRing&);
+};
+
+// Blocks that lie back to back on disk are fetched in one read of up to
+// this many bytes (one range request for remote files).
+static const uint64_t PIPELINE_READ_BYTES = 1u << 20;
+// How many reads (and inflated blocks) a stage may run ahead of the next.
+static const size_t PIPELINE_DEPTH = 8;
+// Queries of fewer blocks are read inline: starting threads would cost more
+// than the overlap gains.
+static const uint64_t PIPELINE_MIN_BLOCKS = 4;
+
+// How many blocks from i on, before `last`, lie back to back on disk within
+// PIPELINE_READ_BYTES (at least one), so that one bwFetchBlocks() call reads
+// them all; their size goes to *bytes.
+inline uint64_t bw_run_blocks(const bwBlockList_t* blocks, uint64_t i, uint64_t last, uint64_t* bytes) {
+  uint64_t n = 1;
+  *bytes = blocks->size[i];
+  while (i + n < last &&
+         blocks->offset[i + n] == blocks->offset[i + n - 1] + blocks->size[i + n - 1] &&
+         *bytes + blocks->size[i + n] <= PIPELINE_READ_BYTES)
+    *bytes += blocks->size[i + n++];
+  return n;
+}
+
+struct BwFetchedRun {
+  uint64_t first, n;                 // blocks [first, first + n)
+  std::vector<unsigned char> bytes;
+};
+
+struct BwInflatedBlock {
+  uint64_t i, size;
+  std::vector<unsigned char> bytes;
+};
+
+// sink(iv) for every block of `blocks` in order, with the block's intervals
+// on `tid` overlapping [start, end); iv is freed once sink returns. Returns
+// 1 on success, 0 on a read or decode error (after the blocks before it
+// have been handed on) and -1, having handed on nothing, if the stage
+// threads couldn't be started. An exception from sink stops the stages and
+// is rethrown.
+template <typename Sink>
+int bw_pipeline_blocks(bigWigFile_t* bw, const bwBlockList_t* blocks, uint32_t tid,
+                        uint32_t start, uint32_t end, Sink sink) {
+  BwRing<BwFetchedRun> fetched(PIPELINE_DEPTH);
+  BwRing<BwInflatedBlock> inflated(PIPELINE_DEPTH);
+  std::atomic<bool> failed(false);
+
+  std::thread io, inflater;
+  try {
+    io = std::thread([&] {
+      try {
+        for (uint64_t i = 0; i < blocks->n; ) {
+          BwFetchedRun run;
+          uint64_t bytes;
+          run.first = i;
+          run.n = bw_run_blocks(blocks, i, blocks->n, &bytes);
+          run.bytes.resize(bytes);
+          if (bwFetchBlocks(bw, blocks, i, run.n, run.bytes.data()) != 0) {
+            failed = true;
+            break;
+          }
+          i += run.n;
+          if (!fetched.push(run)) break;
+        }
+      } catch (...) {   // bad_alloc: an exception must not leave the thread
+        failed = true;
+        inflated.close();
+      }
+      fetched.close();
+    });
+  } catch (const std::system_error&) {
+    return -1;
+  }
+
+  try {
+    inflater = std::thread([&] {
+      try {
+        BwFetchedRun run;
+        bool ok = true;
+        while (ok && fetched.pop(run)) {
+          size_t at = 0;
+          for (uint64_t k = 0; ok && k < run.n; ++k) {
+            BwInflatedBlock b;
+            b.i = run.first + k;
+            const uint64_t sz = blocks->size[b.i];
+            b.bytes.resize(bw->hdr->bufSize ? bw->hdr->bufSize : sz);
+            if (bwInflateBlock(bw, run.bytes.data() + at, sz, b.bytes.data(), &b.size) != 0) {
+              failed = true;
+              ok = false;
+            } else {
+              ok = inflated.push(b);
+            }
+            at += sz;
+          }
+        }
+      } catch (...) {
+        failed = true;
+      }
+      fetched.close();   // stops the I/O stage if this one stopped early
+      inflated.close();
+    });
+  } catch (const std::system_error&) {   // undo the I/O stage
+    fetched.close();
+    io.join();
+    return -1;
+  }
+
+  std::exception_ptr err;
+  uint64_t done = 0;
+  try {
+    BwInflatedBlock b;
+    while (inflated.pop(b)) {
+      bwOverlappingIntervals_t* iv = bwDecodeBlock(b.bytes.data(), b.size, tid, start, end);
+      if (!iv) {
+        failed = true;
+        break;
+      }
+      try {
+        sink(iv);
+      } catch (...) {
+        bwDestroyOverlappingIntervals(iv);
+        throw;
+      }
+      bwDestroyOverlappingIntervals(iv);
+      ++done;
+    }
+  } catch (...) {
+    err = std::current_exception();
+  }
+  inflated.close();
+  inflater.join();
+  io.join();
+  if (err) std::rethrow_exception(err);
+  return !failed && done == blocks->n ? 1 : 0;
+}
+
+// All intervals of `chrom` overlapping [qStart, qEnd), block by block in
+// file order, as sink(iv) (see bw_pipeline_blocks()). Small queries, and
+// any query if the stage threads can't be started, are read inline on the
+// calling thread. Returns false on error.
+template <typename Sink>
+bool bw_stream_intervals(bigWigFile_t* bw, const std::string& chrom, uint32_t qStart,
+                         uint32_t qEnd, Sink sink) {
+  const uint32_t tid = bwGetTid(bw, chrom.c_str());
+  bwBlockList_t* blocks = bwGetBlockList(bw, tid, qStart, qEnd);
+  if (!blocks) return false;
+
+  bool ok = true, inline_read = blocks->n < PIPELINE_MIN_BLOCKS;
+  try {
+    if (!inline_read) {
+      const int rv = bw_pipeline_blocks(bw, blocks, tid, qStart, qEnd, sink);
+      ok = rv == 1;
+      inline_read = rv < 0;
+    }
+    std::vector<unsigned char> raw, buf;
+    for (uint64_t i = 0; inline_read && ok && i < blocks->n; ++i) {
+      uint64_t size;
+      raw.resize(blocks->size[i]);
+      buf.resize(bw->hdr->bufSize ? bw->hdr->bufSize : blocks->size[i]);
+      bwOverlappingIntervals_t* iv = NULL;
+      if (bwFetchBlocks(bw, blocks, i, 1, raw.data()) == 0 &&
+          bwInflateBlock(bw, raw.data(), blocks->size[i], buf.data(), &size) == 0)
+        iv = bwDecodeBlock(buf.data(), size, tid, qStart, qEnd);
+      if (!iv) {
+        ok = false;
+        break;
+      }
+      try {
+        sink(iv);
+      } catch (...) {
+        bwDestroyOverlappingIntervals(iv);
+        throw;
+      }
+      bwDestroyOverlappingIntervals(iv);
+    }
+  } catch (...) {
+    bwDestroyBlockList(blocks);
+    throw;
+  }
+  bwDestroyBlockList(blocks);
+  return ok;
+}
+
+#endif // BWIMPORT_PIPELINE_H
@@ -0,0 +1,150 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+#include "bw_pool.h"
+
+using namespace Rcpp;
+
+// One query position, resolved to a chromosome id and a 0-based base.
+struct PointQuery {
+  uint32_t tid;
+  uint32_t pos;
+  R_xlen_t row;
+};
+
+// Value at every point of one chromosome in a single merge-sweep: points and
+// index blocks are both sorted by position, so each touched block is decoded
+// once and reused by all following points that fall into it. Touches no R
+// API (chromosomes are swept on worker threads); returns false with `err`
+// set if a read fails.
+static bool sweep_points(bigWigFile_t* bw, const std::string& bw_file,
+                         const std::vector<PointQuery>& q, size_t first, size_t last,
+                         double fill, double* out, double& n_blocks, double& n_decoded,
+                         std::string& err) {
+  const uint32_t tid = q[first].tid;
+  bwBlockList_t* blocks = bwGetBlockList(bw, tid, q[first].pos, q[last - 1].pos + 1);
+  if (!blocks) {
+    err = "Failed to read the index of '" + bw_file + "'.";
+    return false;
+  }
+  n_blocks = static_cast<double>(blocks->n);
+
+  uint64_t b = 0, decoded = blocks->n;
+  bwOverlappingIntervals_t* iv = NULL;
+  uint32_t k = 0;
+  for (size_t i = first; i < last; ++i) {
+    const uint32_t p = q[i].pos;
+    while (b < blocks->n && blocks->end[b] <= p) ++b;
+    double v = fill;
+    if (b < blocks->n && blocks->start[b] <= p) {
+      if (b != decoded) {
+        bwDestroyOverlappingIntervals(iv);
+        iv = bwReadBlock(bw, blocks, b, tid);
+        if (!iv) {
+          bwDestroyBlockList(blocks);
+          err = "Failed to read intervals from '" + bw_file + "'.";
+          return false;
+        }
+        decoded = b;
+        k = 0;
+        n_decoded += 1;
+      }
+      while (k < iv->l && iv->end[k] <= p) ++k;
+      if (k < iv->l && iv->start[k] <= p && !std::isnan(iv->value[k]))
+        v = iv->value[k];
+    }
+    out[q[i].row] = v;
+  }
+  if (iv) bwDestroyOverlappingIntervals(iv);
+  bwDestroyBlockList(blocks);
+  return true;
+}
+
+// Values at many single (1-based) positions. Positions are sorted per
+// chromosome and answered in one pass over the blocks they touch, the
+// chromosomes spread over up to `threads` threads sharing one handle;
+// results come back in input order. Bases without data are `fill`; NA
+// positions, positions off the chromosome and unknown chromosomes are NA.
+// attr(, "stats") counts the index blocks overlapping the queried span and
+// those actually decoded.
+// [[Rcpp::export]]
+NumericVector bw_values_at_impl(std::string bw_file, std::vector<std::string> chroms,
+                                IntegerVector positions, double fill, int threads) {
+  const R_xlen_t n = positions.size();
+  if (static_cast<R_xlen_t>(chroms.size()) != n)
+    stop("chrom and pos must have the same length.");
+
+  ensure_bw_init();
+  BwHandle bw(bwOpen(safe_local_path(bw_file).c_str(), NULL, "r"));
+  if (!bw.get())
+    stop("Cannot open BigWig file: %s", bw_file.c_str());
+
+  NumericVector out(n, NA_REAL);
+
+  // Resolve each distinct chromosome name once; runs of equal names are the
+  // common case, so only re-match when the name changes.
+  std::vector<PointQuery> q;
+  q.reserve(n);
+  R_xlen_t n_unknown = 0;
+  std::string last_name;
+  uint32_t tid = (uint32_t) -1;
+  bool have_last = false;
+  for (R_xlen_t i = 0; i < n; ++i) {
+    if (positions[i] == NA_INTEGER) continue;
+    if (!have_last || chroms[i] != last_name) {
+      std::string m = match_chrom(bw.get(), chroms[i]);
+      tid = m.empty() ? (uint32_t) -1 : bwGetTid(bw.get(), m.c_str());
+      last_name = chroms[i];
+      have_last = true;
+    }
+    if (tid == (uint32_t) -1) {
+      ++n_unknown;
+      continue;
+    }
+    const int p = positions[i];
+    if (p < 1 || static_cast<uint32_t>(p) > bw.get()->cl->len[tid]) continue;
+    PointQuery pq = { tid, static_cast<uint32_t>(p - 1), i };
+    q.push_back(pq);
+  }
+
+  std::sort(q.begin(), q.end(), [](const PointQuery& a, const PointQuery& b) {
+    return a.tid != b.tid ? a.tid < b.tid : a.pos < b.pos;
+  });
+
+  // Chromosome k is q[first[k], first[k + 1]); each writes only its own
+  // points' entries of `out` and its own counts.
+  std::vector<size_t> first;
+  for (size_t i = 0; i < q.size(); ++i)
+    if (i == 0 || q[i].tid != q[i - 1].tid) first.push_back(i);
+  const size_t n_chroms = first.size();
+  first.push_back(q.size());
+
+  std::vector<double> blocks(n_chroms, 0.0), decoded(n_chroms, 0.0);
+  std::vector<std::string> errors(n_chroms);
+  double* o = out.begin();
+  bw_parallel_for(n_chroms, bw_thread_count(threads, n_chroms),
+                  [&](size_t k) {
+                    sweep_points(bw.get(), bw_file, q, first[k], first[k + 1], fill, o,
+                                 blocks[k], decoded[k], errors[k]);
+                  },
+                  [&](size_t k) { errors[k] = "Out of memory while reading '" + bw_file + "'."; });
+  for (size_t k = 0; k < n_chroms; ++k)
+    if (!errors[k].empty()) stop(errors[k]);
+  double n_blocks = 0, n_decoded = 0;
+  for (size_t k = 0; k < n_chroms; ++k) {
+    n_blocks += blocks[k];
+    n_decoded += decoded[k];
+  }
+
+  if (n_unknown > 0)
+    warning("%d position(s) on chromosomes not in '%s' are NA.",
+            static_cast<int>(n_unknown), bw_file.c_str());
+  out.attr("stats") = NumericVector::create(_["blocks"] = n_blocks,
+                                            _["blocks_decoded"] = n_decoded);
+  return out;
+}
@@ -0,0 +1,88 @@
+#ifndef BWIMPORT_POOL_H
+#define BWIMPORT_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// The package's thread pool: batch entry points (many files, chromosomes or
+// chunks) run their independent tasks through it. Tasks must stick to plain
+// C++ data and never touch the R API; results go into per-task slots (a
+// matrix column, a vector element, an error string) so the outcome doesn't
+// depend on which thread ran what. ensure_bw_init() must run on the main
+// thread first.
+
+// Threads to use for `n_tasks` tasks: `threads` (<= 0: one per core), at
+// most one per task and at least 1. R passes getOption("bwimport.threads").
+inline unsigned int bw_thread_count(int threads, size_t n_tasks) {
+  unsigned int n = threads > 0 ? static_cast<unsigned int>(threads)
+                               : std::max(1u, std::thread::hardware_concurrency());
+  return static_cast<unsigned int>(std::min<size_t>(n, std::max<size_t>(1, n_tasks)));
+}
+
+// Hands out task indices 0 .. n-1 once each, in order, to whichever thread
+// asks next; a thread held up by a slow task simply takes fewer.
+class BwTaskQueue {
+public:
+  explicit BwTaskQueue(size_t n) : n_(n), next_(0) {}
+  bool pop(size_t& i) {
+    i = next_.fetch_add(1);
+    return i < n_;
+  }
+private:
+  size_t n_;
+  std::atomic<size_t> next_;
+};
+
+// Runs worker(main_thread) on `n_threads` threads, the calling thread being
+// one of them (main_thread = true), and joins them. If a thread can't be
+// started the others, at least the calling one, take its share. Workers
+// that need per-thread state (e.g. scratch buffers) set it up here and pull
+// tasks from a BwTaskQueue. One bigWigFile_t may be shared by all of them.
+// Nothing may escape worker(false); an exception from worker(true) (e.g.
+// Rcpp::stop()) is rethrown once the other threads have been joined.
+template <typename Worker>
+inline void bw_run_workers(unsigned int n_threads, Worker worker) {
+  std::vector<std::thread> pool;
+  try {
+    pool.reserve(n_threads);
+  } catch (...) {
+    n_threads = 1;
+  }
+  for (unsigned int t = 1; t < n_threads; ++t) {
+    try {
+      pool.push_back(std::thread(worker, false));
+    } catch (...) {
+      break;
+    }
+  }
+  try {
+    worker(true);
+  } catch (...) {
+    for (size_t t = 0; t < pool.size(); ++t) pool[t].join();
+    throw;
+  }
+  for (size_t t = 0; t < pool.size(); ++t) pool[t].join();
+}
+
+// task(i) for every i in [0, n) on up to `n_threads` threads. An exception
+// escaping task(i) is caught on its thread and reported as on_error(i), so
+// one failing file or region never takes the others down.
+template <typename Task, typename OnError>
+inline void bw_parallel_for(size_t n, unsigned int n_threads, Task task, OnError on_error) {
+  BwTaskQueue queue(n);
+  bw_run_workers(n_threads, [&](bool) {
+    size_t i;
+    while (queue.pop(i)) {
+      try {
+        task(i);
+      } catch (...) {
+        on_error(i);
+      }
+    }
+  });
+}
+
+#endif // BWIMPORT_POOL_H
@@ -0,0 +1,121 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+
+#include "bw_helpers.h"
+#include "bw_pipeline.h"
+
+using namespace Rcpp;
+
+typedef std::chrono::steady_clock bw_clock;
+
+static double ms_since(const bw_clock::time_point& t0) {
+  return std::chrono::duration<double, std::milli>(bw_clock::now() - t0).count();
+}
+
+// Paint each zoom record's mean over its whole span. Records only say how
+// many of their bases carry data, not which, so this is a preview.
+static void paint_zoom(const bwZoomRecords_t* z, uint32_t qStart, uint32_t qEnd, double* out) {
+  for (uint32_t i = 0; i < z->l; ++i) {
+    if (z->end[i] <= qStart || z->start[i] >= qEnd || z->nBases[i] == 0) continue;
+    uint32_t paintStart = std::max(z->start[i], qStart);
+    uint32_t paintEnd   = std::min(z->end[i], qEnd);
+    double v = static_cast<double>(z->sum[i]) / z->nBases[i];
+    if (std::isnan(v)) v = 0.0;
+    std::fill(out + (paintStart - qStart), out + (paintEnd - qStart), v);
+  }
+}
+
+// The coarsest zoom level whose records are no wider than a pixel, or -1 if
+// every level is coarser. Only the chosen level's index is read afterwards,
+// so the first paint costs one small index walk and block read.
+static int32_t coarse_level(const bigWigFile_t* bw, uint32_t bases_per_pixel) {
+  int32_t best = -1;
+  for (int32_t i = 0; i < bw->hdr->nLevels; ++i) {
+    const uint32_t level = bw->hdr->zoomHdrs->level[i];
+    if (level <= bases_per_pixel && (best < 0 || level > bw->hdr->zoomHdrs->level[best])) best = i;
+  }
+  return best;
+}
+
+// Thrown by the full resolution sink to stop at the deadline.
+struct PastDeadline {};
+
+// [[Rcpp::export]]
+NumericVector bw_import_progressive_impl(std::string bw_file, std::string chrom, int start, int end,
+                                         int pixels, double deadline_ms, Nullable<Function> on_coarse) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+
+  const bw_clock::time_point t0 = bw_clock::now();
+
+  std::string chrom_match;
+  BwHandle bw(open_bw_chrom(bw_file, chrom, chrom_match));
+
+  const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
+  const int out_len = end - start + 1;
+  const uint32_t tid = bwGetTid(bw.get(), chrom_match.c_str());
+  const bool has_deadline = deadline_ms > 0 && std::isfinite(deadline_ms);
+
+  // --- Phase 1: coarse answer from the coarsest zoom level with about one
+  //     record per pixel (usually a single small block) ---
+  const int nbins = std::max(1, std::min(pixels, out_len));
+  const int32_t level = coarse_level(bw.get(), static_cast<uint32_t>(out_len / nbins));
+
+  NumericVector coarse;
+  bool have_coarse = false;
+  double coarse_ms = NA_REAL;
+  if (level >= 0) {
+    bwZoomRecords_t* z = bwGetZoomRecords(bw.get(), level, tid, qStart, qEnd);
+    if (z) {
+      coarse = NumericVector(out_len, 0.0);
+      paint_zoom(z, qStart, qEnd, coarse.begin());
+      bwDestroyZoomRecords(z);
+      have_coarse = true;
+      coarse_ms = ms_since(t0);
+      if (on_coarse.isNotNull()) Function(on_coarse.get())(coarse);
+    }
+  }
+
+  // --- Phase 2: full resolution, checking the deadline before it starts
+  //     and after each decoded block. A fetch already in flight (up to
+  //     PIPELINE_READ_BYTES) is waited for, so the deadline can be overrun
+  //     by one read. Without a coarse answer there's nothing to fall back
+  //     on, so the deadline is ignored. ---
+  NumericVector out(out_len, 0.0);
+  double* buf = out.begin();
+  bool complete = true, ok = true;
+  const bool late = have_coarse && has_deadline && ms_since(t0) > deadline_ms;
+  if (late) complete = false;
+  try {
+    if (!late)
+      ok = bw_stream_intervals(bw.get(), chrom_match, qStart, qEnd,
+                               [&](const bwOverlappingIntervals_t* iv) {
+        paint_intervals(iv, qStart, qEnd, buf, 0.0);
+        if (have_coarse && has_deadline && ms_since(t0) > deadline_ms) throw PastDeadline();
+      });
+  } catch (const PastDeadline&) {
+    complete = false;
+  }
+  if (!ok) {
+    if (!have_coarse)
+      stop("Failed to read intervals for %s:%d-%d in '%s'.",
+           chrom.c_str(), start, end, bw_file.c_str());
+    warning("Reading full resolution data failed; returning the coarse result.");
+    complete = false;
+  }
+
+  NumericVector result = complete ? out : coarse;
+  result.attr("stats") = List::create(
+    _["final"]      = complete ? "full" : "coarse",
+    _["level"]      = have_coarse ? level : -1,
+    _["resolution"] = have_coarse ? static_cast<double>(bw.get()->hdr->zoomHdrs->level[level]) : 0.0,
+    _["coarse_ms"]  = coarse_ms,
+    _["total_ms"]   = ms_since(t0)
+  );
+  return result;
+}
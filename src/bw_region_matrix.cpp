@@ -0,0 +1,410 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+#include "bw_pool.h"
+
+using namespace Rcpp;
+
+// Regions closer than this are read with one index query, as long as the
+// combined span stays under MAX_CLUSTER_SPAN.
+static const int64_t MERGE_GAP = 1 << 14;
+static const int64_t MAX_CLUSTER_SPAN = 1 << 22;
+// Clusters are swept as at most this many tasks of consecutive clusters,
+// each folding into its own sink. The split depends only on the regions, so
+// aggregates come out the same whatever the thread count.
+static const size_t MAX_SWEEP_TASKS = 64;
+
+enum RegionStat { STAT_MEAN, STAT_MAX, STAT_SUM };
+
+static RegionStat region_stat(const std::string& stat) {
+  if (stat == "mean") return STAT_MEAN;
+  if (stat == "max")  return STAT_MAX;
+  if (stat == "sum")  return STAT_SUM;
+  stop("Unknown statistic '%s'.", stat.c_str());
+  return STAT_MEAN;
+}
+
+// Where a region sits; the bin edges are derived from it on demand so that
+// nothing per bin is kept per region.
+struct RegionWindow {
+  R_xlen_t row;
+  uint32_t tid;
+  bool minus;
+  int64_t s0, e0;     // region, 0-based half-open
+  int64_t from, to;   // whole window including flanks (may run off the chromosome)
+};
+
+static void push_bins(std::vector<int64_t>& b, int64_t from, int64_t to, int nbins) {
+  for (int i = 1; i <= nbins; ++i)
+    b.push_back(from + static_cast<int64_t>(std::floor(static_cast<double>(to - from) * i / nbins + 0.5)));
+}
+
+// The bin layout shared by every region: reference-point covers
+// [anchor - upstream, anchor + downstream) in bins of `bin_size`;
+// scale-regions is the upstream flank, the body in `nBody` bins and the
+// downstream flank. Upstream/downstream follow the strand.
+struct RegionLayout {
+  bool scale;
+  std::string reference;
+  int upstream, downstream;
+  int nUp, nBody, nDown, ncol;
+
+  RegionLayout(const std::string& mode, const std::string& ref,
+               int up, int down, int bin_size, int body_bins)
+    : reference(ref), upstream(up), downstream(down) {
+    if (bin_size < 1 || up < 0 || down < 0 || up % bin_size != 0 || down % bin_size != 0)
+      stop("upstream and downstream must be non-negative multiples of bin_size.");
+    scale = mode == "scale-regions";
+    if (!scale && mode != "reference-point")
+      stop("Unknown mode '%s'.", mode.c_str());
+    if (scale && body_bins < 1)
+      stop("body_bins must be >= 1.");
+    if (!scale && up + down == 0)
+      stop("upstream + downstream must be positive in reference-point mode.");
+    nUp = up / bin_size;
+    nDown = down / bin_size;
+    nBody = scale ? body_bins : 0;
+    ncol = nUp + nBody + nDown;
+  }
+
+  // Genome-order flanks: upstream is on the right for minus strand.
+  int64_t left(bool minus) const  { return minus ? downstream : upstream; }
+  int64_t right(bool minus) const { return minus ? upstream : downstream; }
+
+  int64_t anchor(const RegionWindow& w) const {
+    if (reference == "center") return (w.s0 + w.e0) / 2;
+    if (reference == "TES")    return w.minus ? w.s0 : w.e0;
+    return w.minus ? w.e0 : w.s0;
+  }
+
+  void place(RegionWindow& w) const {
+    if (scale) {
+      w.from = w.s0 - left(w.minus);
+      w.to = w.e0 + right(w.minus);
+    } else {
+      w.from = anchor(w) - left(w.minus);
+      w.to = anchor(w) + right(w.minus);
+    }
+  }
+
+  // ncol + 1 bin edges in genome order.
+  void bounds(const RegionWindow& w, std::vector<int64_t>& b) const {
+    b.clear();
+    b.push_back(w.from);
+    if (scale) {
+      push_bins(b, w.from, w.s0, w.minus ? nDown : nUp);
+      push_bins(b, w.s0, w.e0, nBody);
+      push_bins(b, w.e0, w.to, w.minus ? nUp : nDown);
+    } else {
+      push_bins(b, w.from, w.to, ncol);
+    }
+  }
+
+  IntegerVector describe() const {
+    return IntegerVector::create(_["upstream"] = nUp, _["body"] = nBody, _["downstream"] = nDown);
+  }
+};
+
+// Per-bin statistic from the intervals of `iv` (sorted, non-overlapping).
+// Bases off the chromosome are ignored; bases without data count as `fill`,
+// or are ignored too when fill is NA. A bin with nothing to summarise is NA.
+static double bin_stat(const bwOverlappingIntervals_t* iv, uint32_t& k,
+                       int64_t bs, int64_t be, uint32_t chromLen,
+                       RegionStat stat, double fill) {
+  bs = std::max<int64_t>(bs, 0);
+  be = std::min<int64_t>(be, chromLen);
+  if (be <= bs) return NA_REAL;
+
+  while (k < iv->l && iv->end[k] <= bs) ++k;
+  double sum = 0.0, mx = R_NegInf;
+  int64_t covered = 0;
+  for (uint32_t j = k; j < iv->l && iv->start[j] < be; ++j) {
+    float v = iv->value[j];
+    if (std::isnan(v)) continue;
+    int64_t o = std::min<int64_t>(iv->end[j], be) - std::max<int64_t>(iv->start[j], bs);
+    if (o <= 0) continue;
+    sum += static_cast<double>(v) * o;
+    mx = std::max(mx, static_cast<double>(v));
+    covered += o;
+  }
+
+  const int64_t gaps = (be - bs) - covered;
+  const bool use_fill = !ISNAN(fill) && gaps > 0;
+  if (covered == 0 && !use_fill) return NA_REAL;
+  switch (stat) {
+  case STAT_MAX:
+    return use_fill ? std::max(mx, fill) : mx;
+  case STAT_SUM:
+    return use_fill ? sum + fill * gaps : sum;
+  default:
+    return use_fill ? (sum + fill * gaps) / (be - bs) : sum / covered;
+  }
+}
+
+// Resolve chromosomes (once per distinct name) and place every region.
+// Regions on chromosomes the file lacks are skipped and counted.
+static std::vector<RegionWindow> place_regions(bigWigFile_t* bw, const RegionLayout& L,
+                                               const std::vector<std::string>& chroms,
+                                               const IntegerVector& starts, const IntegerVector& ends,
+                                               const std::vector<std::string>& strands,
+                                               R_xlen_t& n_unknown) {
+  const R_xlen_t n = starts.size();
+  if (static_cast<R_xlen_t>(chroms.size()) != n || ends.size() != n ||
+      static_cast<R_xlen_t>(strands.size()) != n)
+    stop("chrom, start, end and strand must have the same length.");
+
+  std::map<std::string, std::string> resolved;
+  std::vector<RegionWindow> wins;
+  wins.reserve(n);
+  n_unknown = 0;
+  for (R_xlen_t i = 0; i < n; ++i) {
+    if (starts[i] == NA_INTEGER || ends[i] == NA_INTEGER || starts[i] < 1 || ends[i] < starts[i])
+      stop("Invalid coordinates in region %d: start must be >= 1 and end >= start.",
+           static_cast<int>(i + 1));
+    std::map<std::string, std::string>::iterator it = resolved.find(chroms[i]);
+    if (it == resolved.end())
+      it = resolved.insert(std::make_pair(chroms[i], match_chrom(bw, chroms[i]))).first;
+    if (it->second.empty()) { ++n_unknown; continue; }
+
+    RegionWindow w;
+    w.row = i;
+    w.tid = bwGetTid(bw, it->second.c_str());
+    w.minus = strands[i] == "-";
+    w.s0 = starts[i] - 1;
+    w.e0 = ends[i];
+    L.place(w);
+    wins.push_back(w);
+  }
+  return wins;
+}
+
+// Sort the windows by position and read them in clusters of nearby windows,
+// one index query per cluster. Consecutive clusters are grouped into
+// sinks.size() tasks run on up to `n_threads` threads sharing `bw`; task t
+// calls sinks[t](row, values) with each region's bins already flipped to
+// read 5' to 3'. Sinks must stick to plain C++ data (see bw_pool.h).
+template <class Sink>
+static void sweep_regions(bigWigFile_t* bw, const std::string& bw_file, const RegionLayout& L,
+                          std::vector<RegionWindow>& wins, RegionStat st, double fill,
+                          unsigned int n_threads, std::vector<Sink>& sinks) {
+  std::sort(wins.begin(), wins.end(), [](const RegionWindow& a, const RegionWindow& b) {
+    if (a.tid != b.tid) return a.tid < b.tid;
+    return a.from < b.from;
+  });
+
+  // Cluster k is wins[first[k], first[k + 1]).
+  std::vector<size_t> first;
+  for (size_t c = 0; c < wins.size(); ) {
+    first.push_back(c);
+    int64_t cTo = wins[c].to;
+    const int64_t cFrom = wins[c].from;
+    const uint32_t tid = wins[c].tid;
+    for (++c; c < wins.size() && wins[c].tid == tid && wins[c].from <= cTo + MERGE_GAP &&
+              std::max(cTo, wins[c].to) - cFrom <= MAX_CLUSTER_SPAN; ++c)
+      cTo = std::max(cTo, wins[c].to);
+  }
+  const size_t n_clusters = first.size();
+  first.push_back(wins.size());
+  if (n_clusters == 0) return;
+
+  const size_t n_tasks = std::min(sinks.size(), n_clusters);
+  std::vector<std::string> errors(n_tasks);
+  BwTaskQueue queue(n_tasks);
+  bw_run_workers(std::min<unsigned int>(n_threads, static_cast<unsigned int>(n_tasks)), [&](bool) {
+    std::vector<int64_t> edges;
+    std::vector<double> row;
+    bwOverlappingIntervals_t* iv = NULL;
+    size_t t;
+    while (queue.pop(t)) {
+      try {
+        row.resize(L.ncol);
+        for (size_t k = n_clusters * t / n_tasks; k < n_clusters * (t + 1) / n_tasks; ++k) {
+          const uint32_t tid = wins[first[k]].tid;
+          const uint32_t chromLen = bw->cl->len[tid];
+          int64_t cTo = wins[first[k]].to;
+          for (size_t c = first[k]; c < first[k + 1]; ++c) cTo = std::max(cTo, wins[c].to);
+          const uint32_t qStart = static_cast<uint32_t>(std::max<int64_t>(wins[first[k]].from, 0));
+          const uint32_t qEnd   = static_cast<uint32_t>(std::min<int64_t>(cTo, chromLen));
+          if (qEnd > qStart) {
+            iv = bwGetOverlappingIntervals(bw, bw->cl->chrom[tid], qStart, qEnd);
+            if (!iv) {
+              errors[t] = "Failed to read intervals for " + std::string(bw->cl->chrom[tid]) + ":" +
+                          std::to_string(qStart + 1) + "-" + std::to_string(qEnd) +
+                          " in '" + bw_file + "'.";
+              break;
+            }
+          }
+
+          for (size_t c = first[k]; c < first[k + 1]; ++c) {
+            const RegionWindow& w = wins[c];
+            if (iv) {
+              // Windows in a cluster are sorted by start but may overlap, so
+              // each one searches for its first interval.
+              L.bounds(w, edges);
+              uint32_t j = static_cast<uint32_t>(
+                std::upper_bound(iv->end, iv->end + iv->l,
+                                 static_cast<uint32_t>(std::max<int64_t>(w.from, 0))) - iv->end);
+              for (int b = 0; b < L.ncol; ++b)
+                row[b] = bin_stat(iv, j, edges[b], edges[b + 1], chromLen, st, fill);
+              if (w.minus) std::reverse(row.begin(), row.end());
+            } else {
+              std::fill(row.begin(), row.end(), NA_REAL);
+            }
+            sinks[t](w.row, row);
+          }
+          if (iv) bwDestroyOverlappingIntervals(iv);
+          iv = NULL;
+        }
+      } catch (...) {   // bad_alloc: must not escape a worker thread
+        if (iv) bwDestroyOverlappingIntervals(iv);
+        iv = NULL;
+        errors[t] = "Out of memory while reading '" + bw_file + "'.";
+      }
+    }
+  });
+
+  for (size_t t = 0; t < n_tasks; ++t)
+    if (!errors[t].empty()) stop(errors[t]);
+}
+
+static bigWigFile_t* open_bw(const std::string& bw_file) {
+  ensure_bw_init();
+  bigWigFile_t* bw = bwOpen(safe_local_path(bw_file).c_str(), NULL, "r");
+  if (!bw)
+    stop("Cannot open BigWig file: %s", bw_file.c_str());
+  return bw;
+}
+
+static void warn_unknown(R_xlen_t n_unknown, const std::string& bw_file, const char* what) {
+  if (n_unknown > 0)
+    warning("%d region(s) on chromosomes not in '%s' %s.",
+            static_cast<int>(n_unknown), bw_file.c_str(), what);
+}
+
+// Writes each row straight into the result; rows of different tasks never
+// meet.
+struct MatrixSink {
+  double* out;
+  R_xlen_t n;
+  void operator()(R_xlen_t r, const std::vector<double>& row) {
+    for (size_t b = 0; b < row.size(); ++b) out[r + static_cast<R_xlen_t>(b) * n] = row[b];
+  }
+};
+
+// Regions x bins signal matrix in the style of deepTools computeMatrix; see
+// RegionLayout for the two modes. Rows are in input order.
+// [[Rcpp::export]]
+NumericMatrix bw_region_matrix_impl(std::string bw_file, std::vector<std::string> chroms,
+                                    IntegerVector starts, IntegerVector ends,
+                                    std::vector<std::string> strands,
+                                    std::string mode, std::string reference,
+                                    int upstream, int downstream, int bin_size, int body_bins,
+                                    std::string stat, double fill, int threads) {
+  const RegionLayout L(mode, reference, upstream, downstream, bin_size, body_bins);
+  const RegionStat st = region_stat(stat);
+  BwHandle bw(open_bw(bw_file));
+
+  R_xlen_t n_unknown;
+  std::vector<RegionWindow> wins = place_regions(bw.get(), L, chroms, starts, ends, strands, n_unknown);
+
+  const R_xlen_t n = starts.size();
+  NumericMatrix out(static_cast<int>(n), L.ncol);
+  std::fill(out.begin(), out.end(), NA_REAL);
+  const MatrixSink sink = { out.begin(), n };
+  std::vector<MatrixSink> sinks(MAX_SWEEP_TASKS, sink);
+  sweep_regions(bw.get(), bw_file, L, wins, st, fill, bw_thread_count(threads, wins.size()), sinks);
+
+  warn_unknown(n_unknown, bw_file, "are NA");
+  out.attr("layout") = L.describe();
+  return out;
+}
+
+// Running per-group, per-bin sums; NA bins are not counted.
+struct AggregateSink {
+  const int* group;             // 0-based group per input row
+  int ncol;
+  std::vector<double> sum, sumsq;
+  std::vector<double> count;
+  void operator()(R_xlen_t r, const std::vector<double>& row) {
+    const size_t off = static_cast<size_t>(group[r]) * ncol;
+    for (int b = 0; b < ncol; ++b) {
+      const double v = row[b];
+      if (ISNAN(v)) continue;
+      sum[off + b] += v;
+      sumsq[off + b] += v * v;
+      count[off + b] += 1.0;
+    }
+  }
+  void add(const AggregateSink& o) {
+    for (size_t i = 0; i < sum.size(); ++i) {
+      sum[i] += o.sum[i];
+      sumsq[i] += o.sumsq[i];
+      count[i] += o.count[i];
+    }
+  }
+};
+
+// Aggregate profile over many regions: the same per-region bins as
+// bw_region_matrix_impl(), but each row is folded into running per-bin sums,
+// sums of squares and counts (per group) and then dropped, so memory does
+// not grow with bins x regions; only each region's RegionWindow is kept.
+// `groups` holds 0-based codes.
+// [[Rcpp::export]]
+List bw_metagene_impl(std::string bw_file, std::vector<std::string> chroms,
+                      IntegerVector starts, IntegerVector ends,
+                      std::vector<std::string> strands, IntegerVector groups, int n_groups,
+                      std::string mode, std::string reference,
+                      int upstream, int downstream, int bin_size, int body_bins,
+                      std::string stat, double fill, int threads) {
+  const RegionLayout L(mode, reference, upstream, downstream, bin_size, body_bins);
+  const RegionStat st = region_stat(stat);
+  if (groups.size() != starts.size())
+    stop("groups must have one entry per region.");
+  for (R_xlen_t i = 0; i < groups.size(); ++i)
+    if (groups[i] < 0 || groups[i] >= n_groups)
+      stop("Invalid group code for region %d.", static_cast<int>(i + 1));
+  BwHandle bw(open_bw(bw_file));
+
+  R_xlen_t n_unknown;
+  std::vector<RegionWindow> wins = place_regions(bw.get(), L, chroms, starts, ends, strands, n_unknown);
+
+  // One set of sums per task, added up in task order; fewer tasks if many
+  // groups would make them large.
+  const size_t cells = static_cast<size_t>(n_groups) * L.ncol;
+  const size_t task_bytes = std::max<size_t>(1, cells * 3 * sizeof(double));
+  const size_t n_tasks = std::max<size_t>(1, std::min(MAX_SWEEP_TASKS, (size_t(64) << 20) / task_bytes));
+  const AggregateSink zero = { groups.begin(), L.ncol, std::vector<double>(cells, 0.0),
+                               std::vector<double>(cells, 0.0), std::vector<double>(cells, 0.0) };
+  std::vector<AggregateSink> sinks(n_tasks, zero);
+  sweep_regions(bw.get(), bw_file, L, wins, st, fill, bw_thread_count(threads, wins.size()), sinks);
+  AggregateSink& sink = sinks[0];
+  for (size_t t = 1; t < sinks.size(); ++t) sink.add(sinks[t]);
+  warn_unknown(n_unknown, bw_file, "were skipped");
+
+  // Group x bin matrices.
+  NumericMatrix mean(n_groups, L.ncol), sd(n_groups, L.ncol), sum(n_groups, L.ncol),
+                sumsq(n_groups, L.ncol), count(n_groups, L.ncol);
+  for (int g = 0; g < n_groups; ++g) {
+    for (int b = 0; b < L.ncol; ++b) {
+      const size_t i = static_cast<size_t>(g) * L.ncol + b;
+      const double nb = sink.count[i];
+      sum(g, b) = sink.sum[i];
+      sumsq(g, b) = sink.sumsq[i];
+      count(g, b) = nb;
+      mean(g, b) = nb > 0 ? sink.sum[i] / nb : NA_REAL;
+      sd(g, b) = nb > 1 ? std::sqrt(std::max(0.0, (sink.sumsq[i] - sink.sum[i] * sink.sum[i] / nb) / (nb - 1)))
+                        : NA_REAL;
+    }
+  }
+
+  List out = List::create(_["mean"] = mean, _["sd"] = sd, _["n"] = count,
+                          _["sum"] = sum, _["sumsq"] = sumsq);
+  out.attr("layout") = L.describe();
+  return out;
+}
@@ -0,0 +1,224 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+
+using namespace Rcpp;
+
+// A stretch of the chromosome that may hold bases above the threshold.
+struct Candidate {
+  uint32_t from, to;
+};
+
+// One reported interval: bases above the threshold, with gaps of at most
+// merge_gap bases closed up. n, sum and max are over the above-threshold
+// bases only.
+struct ScanHit {
+  uint32_t tid, start, end;
+  double n, sum, max;
+};
+
+struct ScanStats {
+  double zoom_records, candidate_records, candidate_bases;
+  double blocks, blocks_decoded, bytes, bytes_decoded;
+};
+
+// Default pruning level: the zoom level whose resolution is closest (in log
+// scale) to the mean span of a full resolution block. Finer levels read more
+// zoom data without saving any decoding; coarser ones prune less.
+static int32_t pick_level(const bigWigFile_t* bw, const bwBlockList_t* blocks, uint32_t chromLen) {
+  if (!bw->hdr->nLevels || !blocks->n) return -1;
+  double span = 0;
+  for (uint64_t b = 0; b < blocks->n; ++b)
+    span += std::min(blocks->end[b], chromLen) - blocks->start[b];
+  span /= static_cast<double>(blocks->n);
+  int32_t best = 0;
+  double bestDist = HUGE_VAL;
+  for (int32_t i = 0; i < bw->hdr->nLevels; ++i) {
+    double d = std::fabs(std::log(bw->hdr->zoomHdrs->level[i] / std::max(span, 1.0)));
+    if (d < bestDist) { bestDist = d; best = i; }
+  }
+  return best;
+}
+
+// Zoom records whose max exceeds the threshold, merged across gaps of at
+// most merge_gap and dropped if shorter than min_length: a qualifying
+// interval lies entirely inside one surviving candidate.
+static bool zoom_candidates(bigWigFile_t* bw, int32_t level, uint32_t tid, double threshold,
+                            uint32_t merge_gap, uint32_t min_length,
+                            std::vector<Candidate>& out, ScanStats& stats) {
+  bwZoomRecords_t* z = bwGetZoomRecords(bw, level, tid, 0, bw->cl->len[tid]);
+  if (!z) return false;
+  stats.zoom_records += z->l;
+  bool open = false;
+  Candidate c = { 0, 0 };
+  for (uint32_t i = 0; i < z->l; ++i) {
+    if (!z->nBases[i] || !(z->max[i] > threshold)) continue;
+    stats.candidate_records += 1;
+    if (open && static_cast<uint64_t>(z->start[i]) <= static_cast<uint64_t>(c.to) + merge_gap) {
+      c.to = std::max(c.to, z->end[i]);
+      continue;
+    }
+    if (open && c.to - c.from >= min_length) out.push_back(c);
+    c.from = z->start[i];
+    c.to = z->end[i];
+    open = true;
+  }
+  if (open && c.to - c.from >= min_length) out.push_back(c);
+  bwDestroyZoomRecords(z);
+  for (size_t k = 0; k < out.size(); ++k) stats.candidate_bases += out[k].to - out[k].from;
+  return true;
+}
+
+// Folds above-threshold intervals, in position order, into hits.
+class HitBuilder {
+public:
+  HitBuilder(uint32_t tid, uint32_t merge_gap, uint32_t min_length, std::vector<ScanHit>& out)
+    : tid_(tid), gap_(merge_gap), min_(min_length), out_(out), open_(false) {}
+
+  void add(uint32_t s, uint32_t e, double v) {
+    if (open_ && static_cast<uint64_t>(s) <= static_cast<uint64_t>(cur_.end) + gap_) {
+      cur_.end = std::max(cur_.end, e);
+    } else {
+      flush();
+      ScanHit h = { tid_, s, e, 0.0, 0.0, v };
+      cur_ = h;
+      open_ = true;
+    }
+    cur_.n += e - s;
+    cur_.sum += v * (e - s);
+    if (v > cur_.max) cur_.max = v;
+  }
+
+  void flush() {
+    if (open_ && cur_.end - cur_.start >= min_) out_.push_back(cur_);
+    open_ = false;
+  }
+
+private:
+  uint32_t tid_, gap_, min_;
+  std::vector<ScanHit>& out_;
+  bool open_;
+  ScanHit cur_;
+};
+
+// Scan one chromosome: decode only the full resolution blocks that overlap
+// a candidate (all of them when there is no zoom level to prune with).
+static void scan_chrom(bigWigFile_t* bw, const std::string& bw_file, uint32_t tid,
+                       double threshold, uint32_t merge_gap, uint32_t min_length, int level,
+                       std::vector<ScanHit>& hits, ScanStats& stats) {
+  const uint32_t len = bw->cl->len[tid];
+  bwBlockList_t* blocks = bwGetBlockList(bw, tid, 0, len);
+  if (!blocks)
+    stop("Failed to read the index of '%s'.", bw_file.c_str());
+  stats.blocks += static_cast<double>(blocks->n);
+  for (uint64_t b = 0; b < blocks->n; ++b) stats.bytes += static_cast<double>(blocks->size[b]);
+
+  int32_t lvl = level == NA_INTEGER ? pick_level(bw, blocks, len) : level;
+  if (lvl >= static_cast<int32_t>(bw->hdr->nLevels)) lvl = -1;
+
+  std::vector<Candidate> cand;
+  if (lvl >= 0) {
+    if (!zoom_candidates(bw, lvl, tid, threshold, merge_gap, min_length, cand, stats)) {
+      bwDestroyBlockList(blocks);
+      stop("Failed to read zoom level %d of '%s'.", lvl, bw_file.c_str());
+    }
+  } else {
+    Candidate all = { 0, len };
+    cand.push_back(all);
+    stats.candidate_bases += len;
+  }
+
+  HitBuilder hb(tid, merge_gap, min_length, hits);
+  size_t c = 0;
+  for (uint64_t b = 0; b < blocks->n && c < cand.size(); ++b) {
+    while (c < cand.size() && cand[c].to <= blocks->start[b]) ++c;
+    if (c == cand.size() || cand[c].from >= blocks->end[b]) continue;
+
+    bwOverlappingIntervals_t* iv = bwReadBlock(bw, blocks, b, tid);
+    if (!iv) {
+      bwDestroyBlockList(blocks);
+      stop("Failed to read intervals from '%s'.", bw_file.c_str());
+    }
+    stats.blocks_decoded += 1;
+    stats.bytes_decoded += static_cast<double>(blocks->size[b]);
+    for (uint32_t k = 0; k < iv->l; ++k) {
+      if (iv->value[k] > threshold) hb.add(iv->start[k], iv->end[k], iv->value[k]);
+    }
+    bwDestroyOverlappingIntervals(iv);
+  }
+  hb.flush();
+  bwDestroyBlockList(blocks);
+}
+
+// Intervals where the signal is above `threshold`, over whole chromosomes
+// (all, or those in `chroms`). Above-threshold bases at most `merge_gap`
+// apart are joined, and joined intervals shorter than `min_length` dropped.
+// Zoom level maxima bound the signal, so full resolution blocks are only
+// decoded where a zoom record exceeds the threshold. `level` picks the zoom
+// level (NA: automatic, -1: no pruning). Returns columns for a data.frame
+// and attr(, "stats").
+// [[Rcpp::export]]
+List bw_scan_threshold_impl(std::string bw_file, double threshold, Nullable<CharacterVector> chroms,
+                            int merge_gap, int min_length, int level) {
+  if (merge_gap < 0 || min_length < 1)
+    stop("merge_gap must be >= 0 and min_length >= 1.");
+
+  ensure_bw_init();
+  BwHandle bw(bwOpen(safe_local_path(bw_file).c_str(), NULL, "r"));
+  if (!bw.get())
+    stop("Cannot open BigWig file: %s", bw_file.c_str());
+  const chromList_t* cl = bw.get()->cl;
+
+  std::vector<uint32_t> tids;
+  if (chroms.isNull()) {
+    for (uint32_t t = 0; t < cl->nKeys; ++t) tids.push_back(t);
+  } else {
+    std::vector<std::string> want = as<std::vector<std::string> >(chroms.get());
+    for (size_t i = 0; i < want.size(); ++i) {
+      std::string m = match_chrom(bw.get(), want[i]);
+      if (m.empty())
+        stop("Chromosome '%s' not found in '%s'.", want[i].c_str(), bw_file.c_str());
+      tids.push_back(bwGetTid(bw.get(), m.c_str()));
+    }
+  }
+
+  std::vector<ScanHit> hits;
+  ScanStats stats = { 0, 0, 0, 0, 0, 0, 0 };
+  for (size_t i = 0; i < tids.size(); ++i) {
+    checkUserInterrupt();
+    scan_chrom(bw.get(), bw_file, tids[i], threshold, static_cast<uint32_t>(merge_gap),
+               static_cast<uint32_t>(min_length), level, hits, stats);
+  }
+
+  const int n = static_cast<int>(hits.size());
+  CharacterVector chrom(n);
+  IntegerVector start(no_init(n)), end(no_init(n));
+  NumericVector covered(no_init(n)), mean_v(no_init(n)), max_v(no_init(n));
+  for (int i = 0; i < n; ++i) {
+    const ScanHit& h = hits[i];
+    chrom[i] = cl->chrom[h.tid];
+    start[i] = static_cast<int>(h.start) + 1;   // 1-based inclusive
+    end[i] = static_cast<int>(h.end);
+    covered[i] = h.n;
+    mean_v[i] = h.sum / h.n;
+    max_v[i] = h.max;
+  }
+
+  List out = List::create(_["chrom"] = chrom, _["start"] = start, _["end"] = end,
+                          _["covered"] = covered, _["mean"] = mean_v, _["max"] = max_v);
+  out.attr("stats") = NumericVector::create(
+    _["zoom_records"]      = stats.zoom_records,
+    _["candidate_records"] = stats.candidate_records,
+    _["candidate_bases"]   = stats.candidate_bases,
+    _["blocks"]            = stats.blocks,
+    _["blocks_decoded"]    = stats.blocks_decoded,
+    _["bytes"]             = stats.bytes,
+    _["bytes_decoded"]     = stats.bytes_decoded
+  );
+  return out;
+}
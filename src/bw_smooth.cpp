@@ -0,0 +1,181 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+#include "bw_pipeline.h"
+
+using namespace Rcpp;
+
+// The region's runs, over [from, to): run r covers [start[r], start[r+1])
+// (the last one up to `to`), with NA where there is no value. `sum` and
+// `count` are prefix sums over the non-NA bases before each run start; long
+// double keeps their differences accurate on long chromosomes.
+struct SmoothRuns {
+  uint32_t from, to;
+  std::vector<uint32_t> start;
+  std::vector<double> value;
+  std::vector<long double> sum;
+  std::vector<double> count;
+
+  SmoothRuns(const RleBuilder& rle, uint32_t from_, uint32_t to_) : from(from_), to(to_) {
+    const size_t n = rle.lengths.size();
+    start.resize(n + 1);
+    sum.resize(n + 1);
+    count.resize(n + 1);
+    value = rle.values;
+    start[0] = from;
+    sum[0] = 0;
+    count[0] = 0;
+    for (size_t r = 0; r < n; ++r) {
+      const uint32_t len = static_cast<uint32_t>(rle.lengths[r]);
+      start[r + 1] = start[r] + len;
+      const bool na = std::isnan(value[r]);
+      sum[r + 1] = sum[r] + (na ? 0.0L : static_cast<long double>(value[r]) * len);
+      count[r + 1] = count[r] + (na ? 0 : len);
+    }
+  }
+
+  size_t size() const { return value.size(); }
+  uint32_t end(size_t r) const { return start[r + 1]; }
+};
+
+// Window of the output base at `pos`: [pos - back, pos + fwd], the same
+// alignment as stats::filter(sides = 2), clipped to the fetched runs.
+struct SmoothWindow {
+  uint32_t back, fwd;
+};
+
+// Box kernel from the prefix sums: each window is the sum of two partial
+// runs and the whole runs between them, so the cost is independent of the
+// window width. `lo`/`hi` track the runs holding the window ends.
+static void smooth_box(const SmoothRuns& runs, SmoothWindow w, uint32_t qStart, uint32_t qEnd,
+                       double* out) {
+  size_t lo = 0, hi = 0;
+  for (uint32_t pos = qStart; pos < qEnd; ++pos) {
+    const uint32_t a = pos - std::min(w.back, pos - runs.from);
+    const uint32_t b = static_cast<uint32_t>(
+      std::min<uint64_t>(runs.to, static_cast<uint64_t>(pos) + w.fwd + 1));
+    while (runs.end(lo) <= a) ++lo;
+    while (runs.end(hi) < b) ++hi;
+    const double v_lo = runs.value[lo], v_hi = runs.value[hi];
+    if (lo == hi) {                     // inside one run: its value
+      out[pos - qStart] = v_lo;
+      continue;
+    }
+    const bool na_lo = std::isnan(v_lo), na_hi = std::isnan(v_hi);
+    const uint32_t n_lo = runs.end(lo) - a, n_hi = b - runs.start[hi];
+    const long double s = runs.sum[hi] - runs.sum[lo + 1] +
+                          (na_lo ? 0.0L : static_cast<long double>(v_lo) * n_lo) +
+                          (na_hi ? 0.0L : static_cast<long double>(v_hi) * n_hi);
+    const double c = runs.count[hi] - runs.count[lo + 1] + (na_lo ? 0 : n_lo) + (na_hi ? 0 : n_hi);
+    out[pos - qStart] = c > 0 ? static_cast<double>(s / c) : NA_REAL;
+  }
+}
+
+// Gaussian kernel (sd = a sixth of the window) by direct convolution of the
+// painted window, NA bases weighted 0. Bases whose window lies inside one
+// run take its value; elsewhere the inner loops are plain multiply-adds over
+// contiguous memory that the compiler vectorises. The weights are only
+// re-summed where the window is clipped or holds NA bases.
+static void smooth_gaussian(const SmoothRuns& runs, SmoothWindow w, uint32_t qStart,
+                            uint32_t qEnd, double* out) {
+  const uint32_t n = runs.to - runs.from;
+  std::vector<double> x(n), mask;
+  std::vector<uint32_t> na_before(n + 1, 0);
+  bool any_na = false;
+  for (size_t r = 0; r < runs.size(); ++r) {
+    const bool na = std::isnan(runs.value[r]);
+    any_na = any_na || na;
+    std::fill(x.begin() + (runs.start[r] - runs.from), x.begin() + (runs.end(r) - runs.from),
+              na ? 0.0 : runs.value[r]);
+  }
+  if (any_na) {
+    mask.resize(n);
+    for (size_t r = 0; r < runs.size(); ++r)
+      std::fill(mask.begin() + (runs.start[r] - runs.from), mask.begin() + (runs.end(r) - runs.from),
+                std::isnan(runs.value[r]) ? 0.0 : 1.0);
+    for (uint32_t i = 0; i < n; ++i) na_before[i + 1] = na_before[i] + (mask[i] == 0);
+  }
+
+  const uint32_t k_len = w.back + w.fwd + 1;
+  const double sd = std::max(k_len / 6.0, 1e-9);
+  std::vector<double> kernel(k_len);
+  double k_total = 0;
+  for (uint32_t k = 0; k < k_len; ++k) {
+    const double d = (static_cast<double>(k) - w.back) / sd;
+    kernel[k] = std::exp(-0.5 * d * d);
+    k_total += kernel[k];
+  }
+
+  size_t r = 0;
+  for (uint32_t pos = qStart; pos < qEnd; ++pos) {
+    const uint32_t i = pos - runs.from;
+    const uint32_t a = i - std::min(w.back, i);               // window, relative
+    const uint32_t b = static_cast<uint32_t>(std::min<uint64_t>(n, static_cast<uint64_t>(i) + w.fwd + 1));
+    while (runs.end(r) <= pos) ++r;
+    if (runs.start[r] - runs.from <= a && runs.end(r) - runs.from >= b) {
+      out[pos - qStart] = runs.value[r];
+      continue;
+    }
+    const double* xk = x.data() + a;
+    const double* kk = kernel.data() + (a + w.back - i);
+    const uint32_t len = b - a;
+    double num = 0;
+    for (uint32_t k = 0; k < len; ++k) num += kk[k] * xk[k];
+    double den = k_total;
+    if (len < k_len || (any_na && na_before[b] != na_before[a])) {
+      den = 0;
+      if (any_na) {
+        const double* mk = mask.data() + a;
+        for (uint32_t k = 0; k < len; ++k) den += kk[k] * mk[k];
+      } else {
+        for (uint32_t k = 0; k < len; ++k) den += kk[k];
+      }
+    }
+    out[pos - qStart] = den > 0 ? num / den : NA_REAL;
+  }
+}
+
+// Dense import with a box or Gaussian kernel of `width` bases applied on the
+// fly. The fetch is widened by the kernel's half-widths (within the
+// chromosome), so the edges of the region are smoothed exactly as the same
+// bases inside a larger import would be. NA bases (`fill = NA`) are left out
+// of each window's average.
+// [[Rcpp::export]]
+NumericVector bw_import_smooth_impl(std::string bw_file, std::string chrom, int start, int end,
+                                    double fill, std::string kernel, int width) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+  if (width < 1)
+    stop("The smoothing width must be a positive number of bases.");
+  if (kernel != "box" && kernel != "gaussian")
+    stop("Unknown smoothing kernel '%s'.", kernel.c_str());
+
+  std::string chrom_match;
+  BwHandle bw(open_bw_chrom(bw_file, chrom, chrom_match));
+  const uint32_t chrom_len = bw.get()->cl->len[bwGetTid(bw.get(), chrom_match.c_str())];
+
+  const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
+  SmoothWindow w = { static_cast<uint32_t>(width - 1) / 2, static_cast<uint32_t>(width) / 2 };
+  const uint32_t from = qStart - std::min(w.back, qStart);
+  const uint32_t to = std::max(qEnd, static_cast<uint32_t>(
+    std::min<uint64_t>(chrom_len, static_cast<uint64_t>(qEnd) + w.fwd)));
+
+  RleBuilder rle(to - from, fill);
+  if (!bw_stream_intervals(bw.get(), chrom_match, from, to,
+                           [&](const bwOverlappingIntervals_t* iv) { rle.push(iv, from, to); }))
+    stop("Failed to read intervals for %s:%d-%d in '%s'.",
+         chrom.c_str(), start, end, bw_file.c_str());
+  rle.finish();
+  SmoothRuns runs(rle, from, to);
+
+  NumericVector out(no_init(end - start + 1));
+  if (kernel == "box") smooth_box(runs, w, qStart, qEnd, out.begin());
+  else                 smooth_gaussian(runs, w, qStart, qEnd, out.begin());
+  return out;
+}
@@ -0,0 +1,61 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <cstdlib>
+#include <string>
+
+#include "bw_helpers.h"
+
+using namespace Rcpp;
+
+// Map the R-level statistic name onto libBigWig's enum. The enumerators are
+// qualified with :: because Rcpp's sugar mean/max/min/sum would otherwise be
+// ambiguous with them.
+static enum bwStatsType stats_type(const std::string& type) {
+  if (type == "mean")     return ::mean;
+  if (type == "sd")       return ::stdev;
+  if (type == "max")      return ::max;
+  if (type == "min")      return ::min;
+  if (type == "coverage") return ::cov;
+  if (type == "sum")      return ::sum;
+  stop("Unknown statistic '%s'.", type.c_str());
+  return ::doesNotExist;
+}
+
+// [[Rcpp::export]]
+NumericVector bw_stats_impl(std::string bw_file, std::string chrom, int start, int end,
+                            int nbins, std::string type, double tolerance) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+  if (nbins < 1 || nbins > end - start + 1)
+    stop("nbins must be between 1 and the width of the region.");
+
+  const enum bwStatsType st = stats_type(type);
+
+  std::string chrom_match;
+  BwHandle bw(open_bw_chrom(bw_file, chrom, chrom_match));
+
+  const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
+
+  bwQueryPlan_t plan;
+  double* vals = bwStatsPlanned(bw.get(), chrom_match.c_str(), qStart, qEnd,
+                                static_cast<uint32_t>(nbins), st, tolerance, &plan);
+  if (!vals)
+    stop("Failed to compute statistics for %s:%d-%d in '%s'.",
+         chrom.c_str(), start, end, bw_file.c_str());
+
+  NumericVector out(vals, vals + nbins);
+  std::free(vals);
+
+  out.attr("stats") = List::create(
+    _["level"]        = plan.level,
+    _["resolution"]   = static_cast<double>(plan.resolution),
+    _["blocks"]       = static_cast<double>(plan.nBlocks),
+    _["bytes"]        = static_cast<double>(plan.nBytes),
+    _["full_blocks"]  = static_cast<double>(plan.fullBlocks),
+    _["full_bytes"]   = static_cast<double>(plan.fullBytes),
+    _["full_complete"] = static_cast<bool>(plan.fullComplete),
+    _["candidates"]   = static_cast<int>(plan.nCandidates)
+  );
+  return out;
+}
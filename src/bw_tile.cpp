@@ -0,0 +1,130 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bw_helpers.h"
+#include "bw_pool.h"
+#include "bw_tiles.h"
+
+using namespace Rcpp;
+
+static TileStat tile_stat(const std::string& type) {
+  TileStat st;
+  if (!parse_tile_stat(type, st))
+    stop("Unknown statistic '%s'.", type.c_str());
+  return st;
+}
+
+// Worker threads only see plain C++ data; see bw_pool.h. They all query the
+// handle opened on the main thread: reads are positional and the index is
+// loaded race-free (see bwReadAt() and bwLoadIndex()), so it can be shared.
+struct TileJob {
+  std::string bw_file;
+  bigWigFile_t* bw;
+  std::vector<uint32_t> tids;     // largest chromosome first
+  uint32_t width;
+  TileStat stat;
+  double tolerance;
+  std::vector<std::vector<double> >* values;
+  std::vector<int>* levels;
+  std::vector<std::string>* errors;
+};
+
+static void tile_chrom(TileJob& job, size_t j) {
+  bigWigFile_t* bw = job.bw;
+  const uint32_t tid = job.tids[j];
+  int32_t level;
+  if (!tile_range(bw, tid, 0, bw->cl->len[tid], job.width, job.stat, job.tolerance, NA_REAL,
+                  (*job.values)[j], level)) {
+    (*job.errors)[j] = std::string("Failed to read ") + bw->cl->chrom[tid] + " from '" +
+                       job.bw_file + "'.";
+    const uint32_t n_tiles = static_cast<uint32_t>((bw->cl->len[tid] + job.width - 1ULL) / job.width);
+    (*job.values)[j].assign(n_tiles, NA_REAL);
+  }
+  (*job.levels)[j] = level;
+}
+
+// Fixed-width tiles over whole chromosomes (all of them, or those in
+// `chroms`). Each chromosome is planned like bw_stats(): the cheapest zoom
+// level within `tolerance` of the tile width, else full resolution data, is
+// read in a single pass. Chromosomes are spread over `threads` threads
+// (<= 0: one per core), all sharing one handle and its index. Returns one
+// numeric vector per chromosome, with attributes `lengths`, `levels` and
+// `errors`.
+// [[Rcpp::export]]
+List bw_tile_impl(std::string bw_file, int width, std::string type,
+                  Nullable<CharacterVector> chroms, double tolerance, int threads) {
+  if (width < 1)
+    stop("width must be a positive number of bases.");
+  const TileStat st = tile_stat(type);
+
+  ensure_bw_init();
+  BwHandle bw(bwOpen(safe_local_path(bw_file).c_str(), NULL, "r"));
+  if (!bw.get())
+    stop("Cannot open BigWig file: %s", bw_file.c_str());
+  const chromList_t* cl = bw.get()->cl;
+
+  std::vector<uint32_t> tids;
+  if (chroms.isNull()) {
+    for (uint32_t t = 0; t < cl->nKeys; ++t) tids.push_back(t);
+  } else {
+    std::vector<std::string> want = as<std::vector<std::string> >(chroms.get());
+    for (size_t i = 0; i < want.size(); ++i) {
+      std::string m = match_chrom(bw.get(), want[i]);
+      if (m.empty())
+        stop("Chromosome '%s' not found in '%s'.", want[i].c_str(), bw_file.c_str());
+      tids.push_back(bwGetTid(bw.get(), m.c_str()));
+    }
+  }
+
+  // Hand out the largest chromosomes first so the tail is short ones.
+  std::vector<size_t> order(tids.size());
+  for (size_t j = 0; j < order.size(); ++j) order[j] = j;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return cl->len[tids[a]] > cl->len[tids[b]];
+  });
+
+  const size_t n = tids.size();
+  std::vector<std::vector<double> > values(n);
+  std::vector<int> levels(n, -1);
+  std::vector<std::string> errors(n);
+
+  TileJob job;
+  job.bw_file = bw_file;
+  job.bw = bw.get();
+  job.tids.resize(n);
+  for (size_t j = 0; j < n; ++j) job.tids[j] = tids[order[j]];
+  job.width = static_cast<uint32_t>(width);
+  job.stat = st;
+  job.tolerance = tolerance;
+  job.values = &values;
+  job.levels = &levels;
+  job.errors = &errors;
+
+  bw_parallel_for(n, bw_thread_count(threads, n),
+                  [&](size_t j) { tile_chrom(job, j); },
+                  [&](size_t j) { errors[j] = "Internal error while tiling '" + bw_file + "'."; });
+
+  // Back to the requested (or file) order.
+  const int nc = static_cast<int>(n);
+  List out(nc);
+  CharacterVector names(nc), err(nc);
+  NumericVector lens(nc);
+  IntegerVector lev(nc);
+  for (size_t j = 0; j < n; ++j) {
+    const size_t i = order[j];
+    out[i] = NumericVector(values[j].begin(), values[j].end());
+    names[i] = cl->chrom[tids[i]];
+    lens[i] = cl->len[tids[i]];
+    lev[i] = levels[j];
+    if (errors[j].empty()) err[i] = NA_STRING;
+    else                   err[i] = errors[j];
+  }
+  out.attr("names") = names;
+  out.attr("lengths") = lens;
+  out.attr("levels") = lev;
+  out.attr("errors") = err;
+  return out;
+}
@@ -0,0 +1,153 @@
+#ifndef BWIMPORT_TILES_H
+#define BWIMPORT_TILES_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+extern "C" {
+  #include "bigWig.h"
+}
+
+#include "bw_pipeline.h"
+
+// Fixed-width tile summaries of [from, to) on one chromosome, shared by
+// bw_tile() and bw_correlation(). Tile t covers [from + t*width, ...),
+// the last one clipped to `to`. Touches no R API, so it can run on worker
+// threads, several at once on the same handle.
+
+// Running moments of one tile. `covered` is fractional when zoom records are
+// split across tile boundaries.
+struct TileAcc {
+  double covered, sum, sumsq, min, max;
+};
+
+inline TileAcc tile_acc_init() {
+  TileAcc a = { 0.0, 0.0, 0.0, std::numeric_limits<double>::infinity(),
+                -std::numeric_limits<double>::infinity() };
+  return a;
+}
+
+inline void tile_add(TileAcc& a, double n, double sum, double sumsq, double mn, double mx) {
+  a.covered += n;
+  a.sum     += sum;
+  a.sumsq   += sumsq;
+  if (mn < a.min) a.min = mn;
+  if (mx > a.max) a.max = mx;
+}
+
+enum TileStat { TILE_MEAN, TILE_SD, TILE_MAX, TILE_MIN, TILE_COVERAGE, TILE_SUM };
+
+// False for an unknown name.
+inline bool parse_tile_stat(const std::string& type, TileStat& st) {
+  if      (type == "mean")     st = TILE_MEAN;
+  else if (type == "sd")       st = TILE_SD;
+  else if (type == "max")      st = TILE_MAX;
+  else if (type == "min")      st = TILE_MIN;
+  else if (type == "coverage") st = TILE_COVERAGE;
+  else if (type == "sum")      st = TILE_SUM;
+  else return false;
+  return true;
+}
+
+// Same conventions as bw_stats(): sd is the sample sd over covered bases,
+// coverage the covered fraction of the tile. Tiles without data are
+// `missing`, except for coverage, which is 0.
+inline double tile_value(const TileAcc& a, double width, TileStat st, double missing) {
+  if (st == TILE_COVERAGE) return a.covered / width;
+  if (a.covered <= 0) return missing;
+  switch (st) {
+  case TILE_MEAN: return a.sum / a.covered;
+  case TILE_MAX:  return a.max;
+  case TILE_MIN:  return a.min;
+  case TILE_SUM:  return a.sum;
+  case TILE_SD: {
+    if (a.covered < 2) return 0.0;
+    double var = (a.sumsq - a.sum * a.sum / a.covered) / (a.covered - 1);
+    return var > 0 ? std::sqrt(var) : 0.0;
+  }
+  default: return missing;
+  }
+}
+
+// Share [s, e) out over the tiles it overlaps, calling add(t, bases) for
+// each piece.
+template <typename Add>
+inline void tile_split(uint32_t s, uint32_t e, uint32_t from, uint32_t width, Add add) {
+  while (s < e) {
+    const uint32_t t = (s - from) / width;
+    const uint32_t te = static_cast<uint32_t>(
+      std::min<uint64_t>(e, from + (t + 1ULL) * width));
+    add(t, te - s);
+    s = te;
+  }
+}
+
+// Full resolution: one streaming pass over the blocks, each interval split
+// exactly over the tiles it touches. Returns false if the index or any
+// block can't be read.
+inline bool tile_full(bigWigFile_t* bw, uint32_t tid, uint32_t from, uint32_t to,
+                      uint32_t width, std::vector<TileAcc>& acc) {
+  return bw_stream_intervals(bw, bw->cl->chrom[tid], from, to,
+                             [&](const bwOverlappingIntervals_t* iv) {
+    for (uint32_t i = 0; i < iv->l; ++i) {
+      const double v = iv->value[i];
+      if (std::isnan(v)) continue;
+      tile_split(std::max(iv->start[i], from), std::min(iv->end[i], to), from, width,
+                 [&](uint32_t t, uint32_t n) { tile_add(acc[t], n, n * v, n * v * v, v, v); });
+    }
+  });
+}
+
+// Zoom records: each record's sums are shared out over the tiles it
+// overlaps in proportion to the overlap, as libBigWig's getScalar() does for
+// bwStats(). Records start at their first covered base rather than on a
+// grid, so this is an approximation wherever one straddles a tile boundary.
+inline bool tile_zoom(bigWigFile_t* bw, int32_t level, uint32_t tid, uint32_t from, uint32_t to,
+                      uint32_t width, std::vector<TileAcc>& acc) {
+  bwZoomRecords_t* z = bwGetZoomRecords(bw, level, tid, from, to);
+  if (!z) return false;
+  for (uint32_t i = 0; i < z->l; ++i) {
+    if (!z->nBases[i]) continue;
+    const double span = z->end[i] - z->start[i];
+    tile_split(std::max(z->start[i], from), std::min(z->end[i], to), from, width,
+               [&](uint32_t t, uint32_t n) {
+                 const double f = n / span;
+                 tile_add(acc[t], f * z->nBases[i], f * z->sum[i], f * z->sumsq[i],
+                          z->min[i], z->max[i]);
+               });
+  }
+  bwDestroyZoomRecords(z);
+  return true;
+}
+
+// Plan [from, to) like bw_stats() (the cheapest zoom level within
+// `tolerance` of the tile width, else full resolution data) and summarise it
+// into ceil((to - from) / width) values. Returns false if a read fails;
+// `level` is set to the zoom level used (-1: full resolution).
+inline bool tile_range(bigWigFile_t* bw, uint32_t tid, uint32_t from, uint32_t to, uint32_t width,
+                       TileStat st, double tolerance, double missing,
+                       std::vector<double>& out, int32_t& level) {
+  const uint32_t n_tiles = static_cast<uint32_t>((to - from + width - 1ULL) / width);
+  bwQueryPlan_t plan;
+  level = -1;
+  if (bwPlanStats(bw, tid, from, to, n_tiles, tolerance, &plan)) return false;
+  level = plan.level;
+
+  std::vector<TileAcc> acc(n_tiles, tile_acc_init());
+  bool ok = level < 0 ? tile_full(bw, tid, from, to, width, acc)
+                      : tile_zoom(bw, level, tid, from, to, width, acc);
+  if (!ok) return false;
+
+  out.resize(n_tiles);
+  for (uint32_t t = 0; t < n_tiles; ++t) {
+    const uint64_t ts = from + static_cast<uint64_t>(t) * width;
+    const double w = static_cast<double>(std::min<uint64_t>(to, ts + width) - ts);
+    out[t] = tile_value(acc[t], w, st, missing);
+  }
+  return true;
+}
+
+#endif // BWIMPORT_TILES_H
@@ -0,0 +1,110 @@
+// [[Rcpp::depends(Rcpp)]]
+#include <Rcpp.h>
+#include <cmath>
+#include <string>
+
+#include "bw_helpers.h"
+#include "bw_pipeline.h"
+
+using namespace Rcpp;
+
+// Stored values are float, so float output is a straight copy. It lives in
+// 4-byte elements: an integer vector (the `float` package's float32 layout)
+// or a raw vector of native-endian floats.
+template <class V>
+static V import_float(bigWigFile_t* bw, const std::string& chrom_match,
+                      uint32_t qStart, uint32_t qEnd, double fill, R_xlen_t elts_per_value,
+                      const std::string& bw_file) {
+  const R_xlen_t n = qEnd - qStart;
+  V out(no_init(n * elts_per_value));
+  float* buf = reinterpret_cast<float*>(out.begin());
+  const float f = static_cast<float>(fill);
+  std::fill(buf, buf + n, f);
+
+  if (!bw_stream_intervals(bw, chrom_match, qStart, qEnd, [&](const bwOverlappingIntervals_t* iv) {
+        paint_intervals(iv, qStart, qEnd, buf, f);
+      }))
+    stop("Failed to read intervals from '%s'.", bw_file.c_str());
+  return out;
+}
+
+static int int_fill(double fill) {
+  return ISNAN(fill) ? NA_INTEGER : BwValue<int>::from(static_cast<float>(fill));
+}
+
+static IntegerVector import_integer(bigWigFile_t* bw, const std::string& chrom_match,
+                                    uint32_t qStart, uint32_t qEnd, double fill,
+                                    const std::string& bw_file) {
+  const int f = int_fill(fill);
+  IntegerVector out(static_cast<R_xlen_t>(qEnd - qStart), f);
+  int* buf = out.begin();
+  if (!bw_stream_intervals(bw, chrom_match, qStart, qEnd, [&](const bwOverlappingIntervals_t* iv) {
+        paint_intervals(iv, qStart, qEnd, buf, f);
+      }))
+    stop("Failed to read intervals from '%s'.", bw_file.c_str());
+  return out;
+}
+
+static bool batch_exact(const bwOverlappingIntervals_t* iv) {
+  for (uint32_t i = 0; i < iv->l; ++i)
+    if (!std::isnan(iv->value[i]) && !BwValue<int>::exact(iv->value[i])) return false;
+  return true;
+}
+
+// Paint as integer while every value seen so far is integral. The first block
+// that isn't switches to double: the integers painted so far convert exactly,
+// so nothing is decoded twice.
+static SEXP import_detect(bigWigFile_t* bw, const std::string& chrom_match,
+                          uint32_t qStart, uint32_t qEnd, double fill,
+                          const std::string& bw_file) {
+  const R_xlen_t n = qEnd - qStart;
+  const bool fill_exact = ISNAN(fill) || (fill == std::floor(fill) && std::fabs(fill) < INT_MAX);
+
+  IntegerVector ints;
+  NumericVector dbls;
+  bool as_int = fill_exact;
+  if (as_int) ints = IntegerVector(n, int_fill(fill));
+  else        dbls = NumericVector(n, fill);
+
+  // The sink runs on the calling thread, so it may allocate the double vector.
+  const bool ok = bw_stream_intervals(bw, chrom_match, qStart, qEnd,
+                                      [&](const bwOverlappingIntervals_t* iv) {
+    if (as_int && !batch_exact(iv)) {
+      dbls = NumericVector(no_init(n));
+      for (R_xlen_t i = 0; i < n; ++i)
+        dbls[i] = ints[i] == NA_INTEGER ? NA_REAL : static_cast<double>(ints[i]);
+      ints = IntegerVector();
+      as_int = false;
+    }
+    if (as_int) paint_intervals(iv, qStart, qEnd, ints.begin(), int_fill(fill));
+    else        paint_intervals(iv, qStart, qEnd, dbls.begin(), fill);
+  });
+  if (!ok)
+    stop("Failed to read intervals from '%s'.", bw_file.c_str());
+
+  if (as_int) return ints;
+  return dbls;
+}
+
+// Dense import into a non-double vector. `type` is one of "float" (integer
+// vector holding float32 bits), "float_raw" (raw vector of floats),
+// "integer" (rounded) or "detect" (integer if lossless, else double).
+// [[Rcpp::export]]
+SEXP bw_import_typed_impl(std::string bw_file, std::string chrom, int start, int end,
+                          double fill, std::string type) {
+  if (start < 1 || end < start)
+    stop("Invalid coordinates: start must be >= 1 and end >= start.");
+  if (type != "float" && type != "float_raw" && type != "integer" && type != "detect")
+    stop("Unknown output type '%s'.", type.c_str());
+
+  std::string chrom_match;
+  BwHandle bw(open_bw_chrom(bw_file, chrom, chrom_match));
+
+  const uint32_t qStart = static_cast<uint32_t>(start - 1); // 0-based inclusive
+  const uint32_t qEnd   = static_cast<uint32_t>(end);       // 0-based exclusive
+
+  if (type == "float")     return import_float<IntegerVector>(bw.get(), chrom_match, qStart, qEnd, fill, 1, bw_file);
+  if (type == "float_raw") return import_float<RawVector>(bw.get(), chrom_match, qStart, qEnd, fill, sizeof(float), bw_file);
+  if (type == "integer")   return import_integer(bw.get(), chrom_match, qStart, qEnd, fill, bw_file);
+  return import_detect(bw.get(), chrom_match, qStart, qEnd, fill, bw_file);
+}
@@ -8,6 +8,15 @@
 #include "bigWigIO.h"
 #include <inttypes.h>
 #include <errno.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#endif
+#ifndef NOCURL
+#include <pthread.h>
+#endif
 #include "bw_quiet.h"
  
 size_t GLOBAL_DEFAULTBUFFERSIZE;
@@ -64,6 +73,40 @@ static void bw_curl_apply_common_opts(CURL *h) {
     */
 }
  
+/* Header callback of URL->x.curl: keeps the lines that identify the version
+   of the remote file in URL->version, starting over on each new reply (e.g.
+   after a redirect) */
+static size_t bwKeepVersion(char *line, size_t l, size_t nmemb, void *pURL) {
+    static const char *keep[] = { "etag:", "last-modified:", "content-range:" };
+    URL_t *URL = (URL_t*)pURL;
+    size_t n = l * nmemb, from = 0, len = n, have, i, k;
+    if (n >= 5 && memcmp(line, "HTTP/", 5) == 0) {
+        URL->version[0] = '\0';
+        return n;
+    }
+    while (len && (line[len-1] == '\r' || line[len-1] == '\n')) len--;
+    for (i = 0; i < sizeof(keep) / sizeof(keep[0]); i++) {
+        for (k = 0; keep[i][k] && k < len && tolower((unsigned char)line[k]) == keep[i][k]; k++) ;
+        if (keep[i][k]) continue;
+        /* of Content-Range only the file size counts, not the range asked for */
+        if (i == 2) for (from = len; from > k && line[from-1] != '/'; from--) ;
+        have = strlen(URL->version);
+        if (len - from > sizeof(URL->version) - 2 - have) len = from + sizeof(URL->version) - 2 - have;
+        memcpy(URL->version + have, line + from, len - from);
+        URL->version[have + len - from] = '\n';
+        URL->version[have + len - from + 1] = '\0';
+        break;
+    }
+    return n;
+}
+
+/* Once the first reply is in, later ones (and the handles duplicated from
+   this one) leave URL->version alone */
+static void bwStopKeepingVersion(CURL *h) {
+    curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, NULL);
+    curl_easy_setopt(h, CURLOPT_HEADERDATA, NULL);
+}
+
 uint64_t getContentLength(const URL_t *URL) {
     size_t size = 0;
     if (curl_easy_getinfo(URL->x.curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size) != CURLE_OK) {
@@ -97,6 +140,7 @@ CURLcode urlFetchData(URL_t *URL, unsigned long bufSize) {
  
     rv = curl_easy_perform(URL->x.curl);
     errno = 0; /* clear remnant errno */
+    bwStopKeepingVersion(URL->x.curl);
     
     const char* dbg = getenv("BWIMPORT_DEBUG_CURL");
     if (dbg && dbg[0] == '1') {
@@ -166,6 +210,231 @@ size_t urlRead(URL_t *URL, void *buf, size_t bufSize) {
 #endif
 }
  
+/* Size and modification time of a local file, for URL->version */
+static void file_version(URL_t *URL) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(_fileno(URL->x.fp), &st) != 0) return;
+#else
+    struct stat st;
+    if (fstat(fileno(URL->x.fp), &st) != 0) return;
+#endif
+    (void)snprintf(URL->version, sizeof(URL->version), "%lld %lld",
+                   (long long)st.st_size, (long long)st.st_mtime);
+}
+
+/* Positional read of a local file: nothing in URL changes, so threads can
+   share the FILE*. */
+static size_t file_read_at(URL_t *URL, void *buf, size_t bufSize, size_t pos) {
+    unsigned char *p = (unsigned char*)buf;
+    size_t got = 0;
+#ifdef _WIN32
+    HANDLE h = (HANDLE)_get_osfhandle(_fileno(URL->x.fp));
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    while (got < bufSize) {
+        OVERLAPPED ov;
+        DWORD n = 0;
+        DWORD want = (bufSize - got > 0x40000000U) ? 0x40000000U : (DWORD)(bufSize - got);
+        uint64_t at = (uint64_t)pos + got;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)(at & 0xFFFFFFFFU);
+        ov.OffsetHigh = (DWORD)(at >> 32);
+        if (!ReadFile(h, p + got, want, &n, &ov) || n == 0) break;
+        got += n;
+    }
+#else
+    int fd = fileno(URL->x.fp);
+    while (got < bufSize) {
+        ssize_t n = pread(fd, p + got, bufSize - got, (off_t)(pos + got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+#endif
+    if (got == bufSize) errno = 0;
+    return got;
+}
+
+#ifndef NOCURL
+/* Idle curl handles of a remote URL_t (URL->spare). urlReadAt() borrows one
+   per request, so concurrent reads never share a handle, and gives it back
+   afterwards so its connection stays open for the next request. */
+#define BW_MAX_SPARE_HANDLES 16
+/* Read-ahead: a request for less than bufSize bytes asks for bufSize and the
+   reply is kept, so the index nodes and blocks right after it are served from
+   memory, as urlSeek()'s buffer did for sequential reads. */
+#define BW_READ_AHEAD_WINDOWS 4
+typedef struct {
+    unsigned char *p; /* NULL if unused */
+    size_t pos, len;
+    unsigned long used; /* for least recently used replacement */
+} readAhead_t;
+typedef struct {
+    pthread_mutex_t lock;
+    CURL *idle[BW_MAX_SPARE_HANDLES];
+    int n;
+    readAhead_t win[BW_READ_AHEAD_WINDOWS];
+    unsigned long clock;
+} curlSpare_t;
+
+/* The caller's buffer for one range request */
+typedef struct {
+    unsigned char *p;
+    size_t len, cap;
+} rangeBuf_t;
+
+static size_t bwFillRange(const void *inBuf, size_t l, size_t nmemb, void *pBuf) {
+    rangeBuf_t *b = (rangeBuf_t*)pBuf;
+    size_t copied = l * nmemb;
+    if (copied > b->cap - b->len) /* more than was asked for aborts the transfer */
+        copied = b->cap - b->len;
+    memcpy(b->p + b->len, inBuf, copied);
+    b->len += copied;
+    return copied;
+}
+
+static CURL *borrowHandle(URL_t *URL) {
+    curlSpare_t *s = (curlSpare_t*)URL->spare;
+    CURL *h;
+    pthread_mutex_lock(&s->lock);
+    h = s->n ? s->idle[--s->n] : curl_easy_duphandle(URL->x.curl);
+    pthread_mutex_unlock(&s->lock);
+    if (h) bwStopKeepingVersion(h);
+    return h;
+}
+
+static void returnHandle(URL_t *URL, CURL *h) {
+    curlSpare_t *s = (curlSpare_t*)URL->spare;
+    pthread_mutex_lock(&s->lock);
+    if (s->n < BW_MAX_SPARE_HANDLES) {
+        s->idle[s->n++] = h;
+        h = NULL;
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (h) curl_easy_cleanup(h);
+}
+
+/* One range request, for exactly bufSize bytes at pos */
+static size_t url_fetch_range(URL_t *URL, void *buf, size_t bufSize, size_t pos) {
+    rangeBuf_t b;
+    char range[128];
+    long code = 0;
+    CURLcode rv;
+    CURL *h = borrowHandle(URL);
+    if (!h) {
+        BW_STDERR("[urlReadAt] Couldn't get a curl handle!\n");
+        return 0;
+    }
+
+    b.p = (unsigned char*)buf;
+    b.len = 0;
+    b.cap = bufSize;
+    (void)snprintf(range, sizeof(range), "%zu-%zu", pos, pos + bufSize - 1U);
+    if (curl_easy_setopt(h, CURLOPT_RANGE, range) != CURLE_OK ||
+        curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, bwFillRange) != CURLE_OK ||
+        curl_easy_setopt(h, CURLOPT_WRITEDATA, (void*)&b) != CURLE_OK) {
+        BW_STDERR("[urlReadAt] Couldn't set up the request for %s\n", range);
+        curl_easy_cleanup(h);
+        return 0;
+    }
+    bw_curl_apply_common_opts(h);
+
+    rv = curl_easy_perform(h);
+    errno = 0; /* clear remnant errno */
+    curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &code);
+
+    const char* dbg = getenv("BWIMPORT_DEBUG_CURL");
+    if (dbg && dbg[0] == '1') {
+      double ttot = 0.0;
+      curl_easy_getinfo(h, CURLINFO_TOTAL_TIME, &ttot);
+      BW_STDERR("[bwimport] READ  range=%s  time=%.3fs  dl=%zuB  http=%ld\n",
+              range, ttot, b.len, code);
+    }
+
+    /* Stopping a longer reply once the buffer is full is fine, but a server
+       that ignored the range sent the file from byte 0 */
+    if (rv != CURLE_OK && !(rv == CURLE_WRITE_ERROR && b.len == bufSize)) {
+        BW_STDERR("[urlReadAt] curl_easy_perform returned %s for %s\n", curl_easy_strerror(rv), range);
+        b.len = 0;
+    } else if (URL->type != BWG_FTP && pos != 0 && code != 206) {
+        BW_STDERR("[urlReadAt] The server ignored the range %s (HTTP %ld)\n", range, code);
+        b.len = 0;
+    }
+    returnHandle(URL, h);
+    return b.len;
+}
+
+/* Copy [pos, pos+bufSize) from memBuf or a read-ahead window if one holds all
+   of it. memBuf is what bwOpen() read through urlRead()/urlSeek(); nothing
+   writes it once the file is open. Returns 1 on a hit. */
+static int read_ahead_hit(URL_t *URL, void *buf, size_t bufSize, size_t pos) {
+    curlSpare_t *s = (curlSpare_t*)URL->spare;
+    int i, hit = 0;
+    if (URL->memBuf && URL->filePos != (size_t)-1 &&
+        pos >= URL->filePos && pos + bufSize <= URL->filePos + URL->bufLen) {
+        memcpy(buf, URL->memBuf + (pos - URL->filePos), bufSize);
+        return 1;
+    }
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < BW_READ_AHEAD_WINDOWS && !hit; i++) {
+        readAhead_t *w = &s->win[i];
+        if (w->p && pos >= w->pos && pos + bufSize <= w->pos + w->len) {
+            memcpy(buf, w->p + (pos - w->pos), bufSize);
+            w->used = ++s->clock;
+            hit = 1;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return hit;
+}
+
+/* Keep p (len bytes at pos) in place of the least recently used window */
+static void read_ahead_keep(URL_t *URL, unsigned char *p, size_t len, size_t pos) {
+    curlSpare_t *s = (curlSpare_t*)URL->spare;
+    readAhead_t *w = &s->win[0];
+    int i;
+    pthread_mutex_lock(&s->lock);
+    for (i = 1; i < BW_READ_AHEAD_WINDOWS; i++) {
+        if (!w->p) break;
+        if (!s->win[i].p || s->win[i].used < w->used) w = &s->win[i];
+    }
+    unsigned char *old = w->p;
+    w->p = p;
+    w->pos = pos;
+    w->len = len;
+    w->used = ++s->clock;
+    pthread_mutex_unlock(&s->lock);
+    free(old);
+}
+
+static size_t url_read_at(URL_t *URL, void *buf, size_t bufSize, size_t pos) {
+    unsigned char *p;
+    size_t got;
+    if (read_ahead_hit(URL, buf, bufSize, pos)) return bufSize;
+    if (bufSize >= URL->bufSize || !(p = (unsigned char*)malloc(URL->bufSize)))
+        return url_fetch_range(URL, buf, bufSize, pos);
+
+    /* a reply cut short by the end of the file is fine */
+    got = url_fetch_range(URL, p, URL->bufSize, pos);
+    if (got < bufSize) {
+        memcpy(buf, p, got);
+        free(p);
+        return got;
+    }
+    memcpy(buf, p, bufSize);
+    read_ahead_keep(URL, p, got, pos);
+    return bufSize;
+}
+#endif /* !NOCURL */
+
+size_t urlReadAt(URL_t *URL, void *buf, size_t bufSize, size_t pos) {
+    if (!bufSize) return 0;
+#ifndef NOCURL
+    if (URL->type != BWG_FILE) return url_read_at(URL, buf, bufSize, pos);
+#endif
+    return file_read_at(URL, buf, bufSize, pos);
+}
+ 
 size_t bwFillBuffer(const void *inBuf, size_t l, size_t nmemb, void *pURL) {
     URL_t *URL = (URL_t*)pURL;
     size_t copied = l * nmemb;
@@ -212,6 +481,7 @@ CURLcode urlSeek(URL_t *URL, size_t pos) {
             bw_curl_apply_common_opts(URL->x.curl);
  
             rv = curl_easy_perform(URL->x.curl);
+            bwStopKeepingVersion(URL->x.curl);
             
             const char* dbg = getenv("BWIMPORT_DEBUG_CURL");
             if (dbg && dbg[0] == '1') {
@@ -248,7 +518,13 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
     char range[128];
 #endif
  
-    URL->fname = fname;
+    /* our own copy: the caller's string need not outlive the open */
+    URL->fname = (const char*)malloc(strlen(fname) + 1);
+    if (!URL->fname) {
+        free(URL);
+        return NULL;
+    }
+    memcpy((char*)URL->fname, fname, strlen(fname) + 1);
  
     if ((!mode) || (strchr(mode, 'w') == 0)) {
         /* detect protocol */
@@ -266,15 +542,18 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
             URL->filePos = (size_t)-1; /* nothing read yet */
             URL->x.fp = fopen(fname, "rb");
             if (!(URL->x.fp)) {
+                free((char*)URL->fname);
                 free(URL);
                 BW_STDERR("[urlOpen] Couldn't open %s for reading\n", fname);
                 return NULL;
             }
+            file_version(URL);
 #ifndef NOCURL
         } else {
             /* remote file */
             URL->memBuf = (unsigned char*)malloc(GLOBAL_DEFAULTBUFFERSIZE);
             if (!(URL->memBuf)) {
+                free((char*)URL->fname);
                 free(URL);
                 BW_STDERR("[urlOpen] Couldn't allocate file buffer!\n");
                 return NULL;
@@ -316,6 +595,11 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
                 BW_STDERR("[urlOpen] Couldn't set CURLOPT_WRITEDATA!\n");
                 goto error;
             }
+            if (curl_easy_setopt(URL->x.curl, CURLOPT_HEADERFUNCTION, bwKeepVersion) != CURLE_OK ||
+                curl_easy_setopt(URL->x.curl, CURLOPT_HEADERDATA, (void*)URL) != CURLE_OK) {
+                BW_STDERR("[urlOpen] Couldn't set CURLOPT_HEADERFUNCTION!\n");
+                goto error;
+            }
  
             /* HTTPS: ignore cert errors (keeps upstream behavior) */
             if (curl_easy_setopt(URL->x.curl, CURLOPT_SSL_VERIFYPEER, 0L) != CURLE_OK) {
@@ -335,6 +619,13 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
                 }
             }
  
+            /* handles for urlReadAt(), duplicated from this one as needed */
+            URL->spare = calloc(1, sizeof(curlSpare_t));
+            if (!(URL->spare) || pthread_mutex_init(&((curlSpare_t*)URL->spare)->lock, NULL) != 0) {
+                BW_STDERR("[urlOpen] Couldn't set up the curl handle pool!\n");
+                goto error;
+            }
+
             /* (no warm-up perform here; first read/seek will fetch) */
  
 #endif /* NOCURL */
@@ -344,6 +635,7 @@ URL_t *urlOpen(const char *fname, CURLcode (*callBack)(CURL*), const char *mode)
         URL->type = BWG_FILE;
         URL->x.fp = fopen(fname, mode);
         if (!(URL->x.fp)) {
+            free((char*)URL->fname);
             free(URL);
             BW_STDERR("[urlOpen] Couldn't open %s for writing\n", fname);
             return NULL;
@@ -359,7 +651,9 @@ error:
     if (url) free(url);
     if (req) free(req);
     free(URL->memBuf);
+    free(URL->spare);
     curl_easy_cleanup(URL->x.curl);
+    free((char*)URL->fname);
     free(URL);
     return NULL;
 #endif
@@ -371,10 +665,17 @@ void urlClose(URL_t *URL) {
         fclose(URL->x.fp);
 #ifndef NOCURL
     } else {
+        curlSpare_t *s = (curlSpare_t*)URL->spare;
+        int i;
+        while (s->n) curl_easy_cleanup(s->idle[--s->n]);
+        for (i = 0; i < BW_READ_AHEAD_WINDOWS; i++) free(s->win[i].p);
+        pthread_mutex_destroy(&s->lock);
+        free(s);
         free(URL->memBuf);
         curl_easy_cleanup(URL->x.curl);
 #endif
     }
+    free((char*)URL->fname);
     free(URL);
 }
 